@@ -23,20 +23,26 @@
 
 #pragma once
 
-#include <map>
 #include <string>
-#include <thread>
+#include <vector>
 #include <memory>
-#include <atomic>
-#include <mutex>
+#include <ctime>
+#include <cstdio>
+#include <cstdint>
+#include <limits>
+#include <functional>
+
+// Watchdog is header-only by default. Define WATCHDOG_COMPILED and build src/Watchdog.cpp
+// (or link the watchdog library target) to only pull the declarations below in each
+// translation unit. All the backends, scanners and state tables are then compiled once.
+#if defined( WATCHDOG_COMPILED )
+    #define WATCHDOG_INLINE
+#else
+    #define WATCHDOG_INLINE inline
+#endif
 
 #ifdef CINDER_CINDER
     #include "cinder/Filesystem.h"
-    #if CINDER_VERSION < 900
-        #include "cinder/app/AppNative.h"
-    #else
-        #include "cinder/app/App.h"
-    #endif
 #else
 	#if defined( CINDER_WINRT ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1900 ) )
         #include <filesystem>
@@ -44,7 +50,7 @@
     #else
         #define BOOST_FILESYSTEM_VERSION 3
         #define BOOST_FILESYSTEM_NO_DEPRECATED
-        #include <boost/filesystem.hpp>
+        #include <boost/filesystem/path.hpp>
         namespace ci { namespace fs = boost::filesystem; }
     #endif
 #endif
@@ -87,381 +93,138 @@ public:
 
 //! Watchdog class. To be able to benefit from the WATCHDOG_ONLY_IN_DEBUG mechanism you should use wd instead of Watchdog
 class Watchdog {
-public:
+protected:
+    class Impl;
+    template<typename T> class PersistentMap;
     
-    //! Watches a file or directory for modification and call back the specified std::function. The path specified is passed as argument of the callback even if there is multiple files. Use the second watch method if you want to receive a list of all the files that have been modified.
-    static void watch( const ci::fs::path &path, const std::function<void(const ci::fs::path&)> &callback )
-    {
-        watchImpl( path, callback, std::function<void(const std::vector<ci::fs::path>&)>() );
-    }
+public:
     
-    //! Watches a file or directory for modification and call back the specified std::function. A list of modified files or directory is passed as argument of the callback. Use this version only if you are watching multiple files or a directory.
-#ifdef WIN_AMBIGUITY_FIX
-    static void watchMany( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback )
-#else
-    static void watch( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback )
-#endif
-    {
-        watchImpl( path, std::function<void(const ci::fs::path&)>(), callback );
-    }
-    //! Unwatches a previously registrated file or directory
-    static void unwatch( const ci::fs::path &path )
-    {
-        watchImpl( path );
-    }
-    //! Unwatches all previously registrated file or directory
-    static void unwatchAll()
-    {
-        watchImpl( ci::fs::path() );
-    }
-    //! Sets the last modification time of a file or directory. by default sets the time to the current time
 #if defined( CINDER_WINRT ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1900 ) )
-    static void touch( const ci::fs::path &path, ci::fs::file_time_type time = ci::fs::file_time_type::clock::now() )
+    typedef ci::fs::file_time_type  FileTime;
 #else
-    static void touch( const ci::fs::path &path, std::time_t time = std::time( nullptr ) )
+    typedef std::time_t             FileTime;
 #endif
-    {
-        
-        // if the file or directory exists change its last write time
-        if( ci::fs::exists( path ) ){
-            ci::fs::last_write_time( path, time );
-            return;
-        }
-        // if not, visit each path if there's a wildcard
-        if( path.string().find( "*" ) != std::string::npos ){
-            visitWildCardPath( path, [time]( const ci::fs::path &p ){
-                ci::fs::last_write_time( p, time );
-                return false;
-            } );
-        }
-        // otherwise throw an exception
-        else {
-            throw WatchedFileSystemExc( path );
-        }
-    }
-    
-protected:
-    
-    Watchdog()
-    : mWatching(false)
-    {
-    }
-    
-    void close()
-    {
-        // remove all watchers
-        unwatchAll();
-        
-        // stop the thread
-        mWatching = false;
-        if( mThread->joinable() ) mThread->join();
-    }
-    
     
-    void start()
-    {
-        mWatching   = true;
-        mThread     = std::unique_ptr<std::thread>( new std::thread( [this](){
-            // keep watching for modifications every ms milliseconds
-            auto ms = std::chrono::milliseconds( 500 );
-            while( mWatching ) {
-                do {
-                    // iterate through each watcher and check for modification
-                    std::lock_guard<std::mutex> lock( mMutex );
-                    auto end = mFileWatchers.end();
-                    for( auto it = mFileWatchers.begin(); it != end; ++it ) {
-                        it->second.watch();
-                    }
-                    // lock will be released before this thread goes to sleep
-                } while( false );
-                
-                // make this thread sleep for a while
-                std::this_thread::sleep_for( ms );
-            }
-        } ) );
-    }
-    static void watchImpl( const ci::fs::path &path, const std::function<void(const ci::fs::path&)> &callback = std::function<void(const ci::fs::path&)>(), const std::function<void(const std::vector<ci::fs::path>&)> &listCallback = std::function<void(const std::vector<ci::fs::path>&)>() )
-    {
-        // create the static Watchdog instance
-        static Watchdog wd;
-        // and start its thread
-        if( !wd.mWatching ) {
-            wd.start();
-            #ifdef CINDER_CINDER
-                #if CINDER_VERSION < 900
-                    ci::app::App::get()->getSignalShutdown().connect( [&]() {
-                #else
-                    ci::app::App::get()->getSignalCleanup().connect( [&]() {
-                #endif
-                        wd.close();
-                    } );
-            #endif
-        }
+    //! An immutable view of the files known to a watcher at some point in time. Paths are the ones passed to the callbacks.
+    class Version {
+    public:
+        Version() {}
         
-        const std::string key = path.string();
+        //! Returns the version number, incremented each time the watcher records a change
+        uint64_t getNumber() const;
+        //! Returns the number of files in this version
+        size_t size() const;
+        //! Returns whether path is part of this version
+        bool contains( const ci::fs::path &path ) const;
+        //! Returns the last write time of path in this version. Throws WatchedFileSystemExc if path is not part of this version.
+        FileTime getLastWriteTime( const ci::fs::path &path ) const;
+        //! Calls visitor with each path of this version and its last write time
+        void visit( const std::function<void(const ci::fs::path&,FileTime)> &visitor ) const;
         
-        // add a new watcher
-        if( callback || listCallback ){
-            
-            std::string filter;
-            ci::fs::path p = path;
-            // try to see if there's a match for the wildcard
-            if( path.string().find( "*" ) != std::string::npos ){
-                bool found = false;
-                std::pair<ci::fs::path,std::string> pathFilter = visitWildCardPath( path, [&found]( const ci::fs::path &p ){
-                    found = true;
-                    return true;
-                } );
-                if( !found ){
-                    throw WatchedFileSystemExc( path );
-                }
-                else {
-                    p       = pathFilter.first;
-                    filter  = pathFilter.second;
-                }
-            }
-            
-#ifdef CINDER_CINDER
-            // try to see if the path is an asset
-            if( !ci::fs::exists( p ) ){
-                ci::fs::path asset = ci::app::getAssetPath( p );
-                if( !asset.empty() ){
-                    p = asset;
-                }
-            }
-            // throw an exception if the file doesn't exist
-            if( !ci::fs::exists( p ) ){
-                throw WatchedFileSystemExc( path );
-            }
-#endif
-            
-            std::lock_guard<std::mutex> lock( wd.mMutex );
-            if( wd.mFileWatchers.find( key ) == wd.mFileWatchers.end() ){
-                wd.mFileWatchers.emplace( make_pair( key, Watcher( p, filter, callback, listCallback ) ) );
-            }
-        }
-        // if there is no callback that means that we are unwatching
-        else {
-            // if the path is empty we unwatch all files
-            if( path.empty() ){
-                std::lock_guard<std::mutex> lock( wd.mMutex );
-                for( auto it = wd.mFileWatchers.begin(); it != wd.mFileWatchers.end(); ) {
-                    it = wd.mFileWatchers.erase( it );
-                }
-            }
-            // or the specified file or directory
-            else {
-                std::lock_guard<std::mutex> lock( wd.mMutex );
-                auto watcher = wd.mFileWatchers.find( key );
-                if( watcher != wd.mFileWatchers.end() ){
-                    wd.mFileWatchers.erase( watcher );
-                }
-            }
-        }
-    }
-    
-    static std::pair<ci::fs::path,std::string> getPathFilterPair( const ci::fs::path &path )
-    {
-        // extract wildcard and parent path
-        std::string key     = path.string();
-        ci::fs::path p      = path;
-        size_t wildCardPos  = key.find( "*" );
-        std::string filter;
-        if( wildCardPos != std::string::npos ){
-            filter  = path.filename().string();
-            p       = path.parent_path();
-        }
+    protected:
+        friend class Impl;
+        struct Data;
         
-#ifdef CINDER_CINDER
-        // try to see if the path is an asset
-        if( !ci::fs::exists( p ) ){
-            ci::fs::path asset = ci::app::getAssetPath( p );
-            if( !asset.empty() ){
-                p = asset;
-            }
-        }
-#endif
-        // throw an exception if the file doesn't exist
-        if( filter.empty() && !ci::fs::exists( p ) ){
-            throw WatchedFileSystemExc( path );
-        }
-#ifdef CINDER_CINDER
-        else if( !filter.empty() && p.empty() ) {
-            // at this stage if the parent directory doesn't exist the only option left is to try with the asset folder
-            p = ci::app::getAssetPath( "" );
+        Version( const std::shared_ptr<const Data> &data )
+        : mData(data)
+        {
         }
-#endif
         
-        return std::make_pair( p, filter );
-            
-    }
+        std::shared_ptr<const Data> mData;
+    };
     
-    static std::pair<ci::fs::path,std::string> visitWildCardPath( const ci::fs::path &path, const std::function<bool(const ci::fs::path&)> &visitor ){
-        std::pair<ci::fs::path, std::string> pathFilter = getPathFilterPair( path );
-        if( !pathFilter.second.empty() ){
-            std::string full    = ( pathFilter.first / pathFilter.second ).string();
-            size_t wildcardPos  = full.find( "*" );
-            std::string before  = full.substr( 0, wildcardPos );
-            std::string after   = full.substr( wildcardPos + 1 );
-            ci::fs::directory_iterator end;
-            for( ci::fs::directory_iterator it( pathFilter.first ); it != end; ++it ){
-                std::string current = it->path().string();
-                size_t beforePos    = current.find( before );
-                size_t afterPos     = current.find( after );
-                if( ( beforePos != std::string::npos || before.empty() )
-                   && ( afterPos != std::string::npos || after.empty() ) ) {
-                    if( visitor( it->path() ) ){
-                        break;
-                    }
-                }
-            }
-        }
-        return pathFilter;
-    }
+    //! Changes detected in a directory during one check
+    struct DirectorySummary {
+        ci::fs::path    directory;
+        size_t          created;
+        size_t          modified;
+        size_t          removed;
+        //! Depth of the deepest change below directory, 0 when all the changes are direct children
+        size_t          maxDepth;
+    };
     
-    class Watcher {
-    public:
-        Watcher( const ci::fs::path &path, const std::string &filter, const std::function<void(const ci::fs::path&)> &callback, const std::function<void(const std::vector<ci::fs::path>&)> &listCallback )
-        : mPath(path), mFilter(filter), mCallback(callback), mListCallback(listCallback)
-        {
-            // make sure we store all initial write time
-            if( !mFilter.empty() ) {
-                std::vector<ci::fs::path> paths;
-                visitWildCardPath( path / filter, [this,&paths]( const ci::fs::path &p ){
-                    hasChanged( p );
-                    paths.push_back( p );
-                    return false;
-                } );
-                // this means that the first watch won't call the callback function
-                // so we have to manually call it here
-                if( mCallback ){
-                    mCallback( mPath / mFilter );
-                }
-                else {
-                    mListCallback( paths );
-                }
-            }
-        }
-        
-        void watch()
-        {
-            // if there's no filter we just check for one item
-            if( mFilter.empty() && hasChanged( mPath ) && mCallback ){
-#ifdef CINDER_CINDER
-                ci::app::App::get()->dispatchAsync( [this](){
-                    mCallback( mPath );
-                } );
-#else
-                mCallback( mPath );
-                //#error TODO: still have to figure out an elegant way to do this without cinder
-#endif
-            }
-            // otherwise we check the whole parent directory
-            else if( !mFilter.empty() ){
-                
-                std::vector<ci::fs::path> paths;
-                visitWildCardPath( mPath / mFilter, [this,&paths]( const ci::fs::path &p ){
-                    bool pathHasChanged = hasChanged( p );
-                    if( pathHasChanged && mCallback ){
-#ifdef CINDER_CINDER
-                        ci::app::App::get()->dispatchAsync( [this](){
-                            mCallback( mPath / mFilter );
-                        } );
+    //! Watches a file or directory for modification and call back the specified std::function. The path specified is passed as argument of the callback even if there is multiple files. Use the second watch method if you want to receive a list of all the files that have been modified.
+    static void watch( const ci::fs::path &path, const std::function<void(const ci::fs::path&)> &callback );
+    
+    //! Watches a file or directory for modification and call back the specified std::function. A list of modified files or directory is passed as argument of the callback. Use this version only if you are watching multiple files or a directory.
+#ifdef WIN_AMBIGUITY_FIX
+    static void watchMany( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback );
 #else
-                        mCallback( mPath / mFilter );
-                        //#error TODO: still have to figure out an elegant way to do this without cinder
+    static void watch( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback );
 #endif
-                        return true;
-                    }
-                    else if( pathHasChanged && mListCallback ){
-                        paths.push_back( p );
-                    }
-                    return false;
-                } );
-                if( paths.size() && mListCallback ){
-                    mListCallback( paths );
-                }
-            }
-            
-        }
-
-		bool hasChanged( const ci::fs::path &path )
-        {
-            // get the last modification time
-            auto time = ci::fs::last_write_time( path );
-            // add a new modification time to the map
-            std::string key = path.string();
-            if( mModificationTimes.find( key ) == mModificationTimes.end() ) {
-                mModificationTimes[ key ] = time;
-                return true;
-            }
-            // or compare with an older one
-            auto &prev = mModificationTimes[ key ];
-            if( prev < time ) {
-                prev = time;
-                return true;
-            }
-            return false;
-        };
-        
-    protected:
-        ci::fs::path                                            mPath;
-        std::string                                             mFilter;
-        std::function<void(const ci::fs::path&)>                mCallback;
-        std::function<void(const std::vector<ci::fs::path>&)>   mListCallback;
+    //! Watches a directory and all its subdirectories and call back the specified std::function with one summary per directory containing changes instead of every modified path. Changes more than depth levels below path are reported in their ancestor depth levels below path.
+    static void watchDirectories( const ci::fs::path &path, const std::function<void(const std::vector<DirectorySummary>&)> &callback, size_t depth = std::numeric_limits<size_t>::max() );
+    //! Unwatches a previously registrated file or directory
+    static void unwatch( const ci::fs::path &path );
+    //! Unwatches all previously registrated file or directory
+    static void unwatchAll();
+    //! Sets the last modification time of a file or directory. by default sets the time to the current time
 #if defined( CINDER_WINRT ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1900 ) )
-		std::map< std::string, ci::fs::file_time_type >         mModificationTimes;
+    static void touch( const ci::fs::path &path, ci::fs::file_time_type time = ci::fs::file_time_type::clock::now() );
 #else
-        std::map< std::string, time_t >                         mModificationTimes;
+    static void touch( const ci::fs::path &path, std::time_t time = std::time( nullptr ) );
 #endif
-    };
+    //! Returns the latest version of the files known to the watcher registered with path, or an empty version if there is none. Versions are immutable and cheap to keep around, the watcher keeps publishing new ones without disturbing the ones in use.
+    static Version getVersion( const ci::fs::path &path );
+    //! Mirrors the content of the source directory into the target directory. Both directories are reconciled once, then creations, modifications, renames and deletions in source are replicated to target. The source tree is rescanned every second, one stat per entry, on a thread started by the first call.
+    static void mirror( const ci::fs::path &source, const ci::fs::path &target );
+    //! Stops mirroring a previously mirrored source directory
+    static void unmirror( const ci::fs::path &source );
+    //! Enables or disables snapshots. When enabled, the files passed to the callbacks are copies taken once a change has been detected. A copy is kept only if the file's size and write times didn't change while it was taken, so it can be read without racing the writer, but a writer that pauses midway through a rewrite can still leave a partial copy. The initial callback of a watch receives the files themselves. Snapshots are cloned with a reflink when the filesystem supports it, so directory should be on the same filesystem as the watched files; it defaults to the temporary directory. A snapshot is only valid until the callback returns.
+    static void setSnapshotsEnabled( bool enabled, const ci::fs::path &directory = ci::fs::path() );
+    //! Enables or disables co-change prefetching. When enabled, Watchdog learns which files are usually modified shortly after each other. When one of them changes, the ones likely to follow are read ahead into the page cache and checked more often for a couple of seconds, so their own changes are picked up and loaded faster. Disabled by default.
+    static void setCoChangePrefetchEnabled( bool enabled );
+    //! Enables or disables reading the initial modification times from the git index when the watched directory is inside a git work tree. The files the index tracks are not stat'ed when the watch starts, a file edited since the last git command that refreshed the index is reported by the first regular check. Disabled by default.
+    static void setGitIndexBootstrapEnabled( bool enabled );
     
+protected:
     friend class SleepyWatchdog;
-    
-    std::mutex                      mMutex;
-    std::atomic<bool>               mWatching;
-    std::unique_ptr<std::thread>    mThread;
-    std::map<std::string,Watcher>   mFileWatchers;
 };
 
 //! this class is only used in release mode when WATCHDOG_ONLY_IN_DEBUG is defined
 class SleepyWatchdog {
 public:
     
+    typedef Watchdog::FileTime          FileTime;
+    typedef Watchdog::Version           Version;
+    typedef Watchdog::DirectorySummary  DirectorySummary;
+    
     //! executes the callback once
-    static void watch( const ci::fs::path &path, const std::function<void(const ci::fs::path&)> &callback )
-    {
-        auto pathFilter = Watchdog::visitWildCardPath( path, []( const ci::fs::path &p ){ return false; } );
-        if( pathFilter.first.empty() ){
-            throw WatchedFileSystemExc( path );
-        }
-        else {
-            callback( pathFilter.first );
-        }
-    }
+    static void watch( const ci::fs::path &path, const std::function<void(const ci::fs::path&)> &callback );
 #ifdef WIN_AMBIGUITY_FIX
-    static void watchMany( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback )
+    static void watchMany( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback );
 #else
-    static void watch( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback )
+    static void watch( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback );
 #endif
-    {
-        auto pathFilter = Watchdog::visitWildCardPath( path, []( const ci::fs::path &p ){ return false; } );
-        if( pathFilter.first.empty() ){
-            throw WatchedFileSystemExc( path );
-        }
-        else {
-            // TODO: this is wrong
-            callback( std::vector<ci::fs::path>() );
-        }
-    }
+    //! does nothing
+    static void watchDirectories( const ci::fs::path &path, const std::function<void(const std::vector<DirectorySummary>&)> &callback, size_t depth = std::numeric_limits<size_t>::max() ) {}
+    
     //! does nothing
     static void unwatch( const ci::fs::path &path ) {}
     
     //! does nothing
     static void unwatchAll() {}
     
+    //! returns an empty version
+    static Version getVersion( const ci::fs::path &path ) { return Version(); }
+    
     //! does nothing
     static void touch( const ci::fs::path &path, std::time_t time = std::time( nullptr ) ) {}
+    
+    //! reconciles the target directory with the source directory once
+    static void mirror( const ci::fs::path &source, const ci::fs::path &target );
+    
+    //! does nothing
+    static void unmirror( const ci::fs::path &source ) {}
+    
+    //! does nothing
+    static void setSnapshotsEnabled( bool enabled, const ci::fs::path &directory = ci::fs::path() ) {}
+    
+    //! does nothing
+    static void setCoChangePrefetchEnabled( bool enabled ) {}
+    
+    //! does nothing
+    static void setGitIndexBootstrapEnabled( bool enabled ) {}
 };
 
 // defines the macro that allow to change the RELEASE/DEBUG behavior
@@ -474,7 +237,12 @@ public:
 #else
     typedef Watchdog wd;
 #endif
+
+// in header-only mode the implementation follows the declarations
+#if !defined( WATCHDOG_COMPILED )
+    #include "WatchdogImpl.h"
+#endif
 	
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
     #pragma warning( pop )
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,2006 @@
+/*
+ 
+ Watchdog
+ 
+ Copyright (c) 2014, Simon Geilfus
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Watchdog.h"
+
+#include <map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <chrono>
+#include <deque>
+#include <bitset>
+#include <unordered_map>
+#include <algorithm>
+
+#if !defined( _WIN32 )
+    #include <sys/stat.h>
+    #include <fcntl.h>
+#endif
+#if defined( __linux__ )
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <linux/fs.h>
+#endif
+
+#ifdef CINDER_CINDER
+    #if CINDER_VERSION < 900
+        #include "cinder/app/AppNative.h"
+    #else
+        #include "cinder/app/App.h"
+    #endif
+#elif !( defined( CINDER_WINRT ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1900 ) ) )
+    #include <boost/filesystem.hpp>
+#endif
+
+//! Hash array mapped trie indexed by path ids. Copies share all their nodes, and modifying a map only copies the nodes between the root and the modified entry that are shared with another copy. Old copies are never modified, so they can be read from any thread without locking.
+template<typename T>
+class Watchdog::PersistentMap {
+public:
+    PersistentMap()
+    : mSize(0)
+    {
+    }
+    
+    size_t size() const { return mSize; }
+    
+    //! Returns a pointer to the value stored for key or nullptr if there is none
+    const T* find( uint32_t key ) const
+    {
+        const Node *node = mRoot.get();
+        for( uint32_t shift = 0; node; shift += 5 ){
+            uint32_t bit = 1u << ( ( key >> shift ) & 31 );
+            if( !( node->bitmap & bit ) ){
+                return nullptr;
+            }
+            const Slot &slot = node->slots[ index( node->bitmap, bit ) ];
+            if( !slot.child ){
+                return slot.key == key ? &slot.value : nullptr;
+            }
+            node = slot.child.get();
+        }
+        return nullptr;
+    }
+    
+    void insert( uint32_t key, const T &value )
+    {
+        insert( mRoot, key, value, 0, mSize );
+    }
+    
+    void erase( uint32_t key )
+    {
+        if( find( key ) ){
+            erase( mRoot, key, 0 );
+            --mSize;
+        }
+    }
+    
+    //! Calls visitor with each key and value
+    void visit( const std::function<void(uint32_t,const T&)> &visitor ) const
+    {
+        if( mRoot ){
+            visit( *mRoot, visitor );
+        }
+    }
+    
+protected:
+    struct Node;
+    struct Slot {
+        std::shared_ptr<Node>   child;
+        uint32_t                key;
+        T                       value;
+    };
+    struct Node {
+        Node() : bitmap(0) {}
+        uint32_t                bitmap;
+        std::vector<Slot>       slots;
+    };
+    
+    static size_t index( uint32_t bitmap, uint32_t bit )
+    {
+        return std::bitset<32>( bitmap & ( bit - 1 ) ).count();
+    }
+    
+    //! Makes sure node can be modified, copying it if another map shares it
+    static void detach( std::shared_ptr<Node> &node )
+    {
+        if( !node ){
+            node = std::make_shared<Node>();
+        }
+        else if( node.use_count() > 1 ){
+            node = std::make_shared<Node>( *node );
+        }
+    }
+    
+    static void insert( std::shared_ptr<Node> &node, uint32_t key, const T &value, uint32_t shift, size_t &size )
+    {
+        detach( node );
+        uint32_t bit = 1u << ( ( key >> shift ) & 31 );
+        size_t i = index( node->bitmap, bit );
+        if( !( node->bitmap & bit ) ){
+            Slot slot;
+            slot.key    = key;
+            slot.value  = value;
+            node->bitmap |= bit;
+            node->slots.insert( node->slots.begin() + i, slot );
+            ++size;
+            return;
+        }
+        
+        Slot &slot = node->slots[ i ];
+        if( slot.child ){
+            insert( slot.child, key, value, shift + 5, size );
+        }
+        else if( slot.key == key ){
+            slot.value = value;
+        }
+        // both keys share the same prefix up to this level, move them one level down
+        else {
+            size_t unused = 0;
+            insert( slot.child, slot.key, slot.value, shift + 5, unused );
+            insert( slot.child, key, value, shift + 5, size );
+        }
+    }
+    
+    static void erase( std::shared_ptr<Node> &node, uint32_t key, uint32_t shift )
+    {
+        detach( node );
+        uint32_t bit = 1u << ( ( key >> shift ) & 31 );
+        size_t i = index( node->bitmap, bit );
+        Slot &slot = node->slots[ i ];
+        if( slot.child ){
+            erase( slot.child, key, shift + 5 );
+            if( !slot.child->slots.empty() ){
+                return;
+            }
+        }
+        node->bitmap &= ~bit;
+        node->slots.erase( node->slots.begin() + i );
+    }
+    
+    static void visit( const Node &node, const std::function<void(uint32_t,const T&)> &visitor )
+    {
+        for( const Slot &slot : node.slots ){
+            if( slot.child ){
+                visit( *slot.child, visitor );
+            }
+            else {
+                visitor( slot.key, slot.value );
+            }
+        }
+    }
+    
+    std::shared_ptr<Node>   mRoot;
+    size_t                  mSize;
+};
+
+struct Watchdog::Version::Data {
+    Data( const PersistentMap<FileTime> &times, uint64_t number )
+    : mTimes(times), mNumber(number)
+    {
+    }
+    
+    PersistentMap<FileTime>     mTimes;
+    uint64_t                    mNumber;
+};
+
+//! Everything behind the Watchdog static functions: the watch thread, the watchers and their state
+class Watchdog::Impl {
+public:
+    
+    Impl()
+    : mWatching(false)
+    {
+    }
+    
+    void close()
+    {
+        // remove all watchers
+        watchImpl( ci::fs::path() );
+        
+        // stop the threads
+        mWatching = false;
+        if( mThread->joinable() ) mThread->join();
+        if( mMirrorThread && mMirrorThread->joinable() ) mMirrorThread->join();
+    }
+    
+    
+    void start()
+    {
+        mWatching   = true;
+        mThread     = std::unique_ptr<std::thread>( new std::thread( [this](){
+            // keep watching for modifications every ms milliseconds
+            auto ms = std::chrono::milliseconds( 500 );
+            // and the files likely to change next every followersMs milliseconds
+            auto followersMs = std::chrono::milliseconds( 50 );
+            auto next = std::chrono::steady_clock::now();
+            while( mWatching ) {
+                // in between two checks, only look at the files likely to change next
+                auto now = std::chrono::steady_clock::now();
+                coChanges().nextTick();
+                if( now < next ) {
+                    std::vector<ci::fs::path> followers = coChanges().getFollowers( now );
+                    if( !followers.empty() ) {
+                        std::lock_guard<std::mutex> lock( mMutex );
+                        for( auto it = mFileWatchers.begin(); it != mFileWatchers.end(); ++it ) {
+                            for( const ci::fs::path &follower : followers ) {
+                                it->second.watch( follower );
+                            }
+                        }
+                    }
+                }
+                else {
+                    {
+                        // list each watched directory once, however many watchers share it
+                        std::lock_guard<std::mutex> lock( mMutex );
+                        mDirectories.update();
+                        // iterate through each watcher and check for modification
+                        auto end = mFileWatchers.end();
+                        for( auto it = mFileWatchers.begin(); it != end; ++it ) {
+                            it->second.watch( mDirectories );
+                        }
+                    }
+                    
+                    // directory watchers scan whole trees, so like the mirrors they run outside of the watchers lock.
+                    // unwatch can drop one while it is scanning, it stays alive until the scan is done
+                    std::vector<std::shared_ptr<DirectoryWatcher>> directoryWatchers;
+                    {
+                        std::lock_guard<std::mutex> lock( mDirectoryWatchersMutex );
+                        for( auto it = mDirectoryWatchers.begin(); it != mDirectoryWatchers.end(); ++it ) {
+                            directoryWatchers.push_back( it->second );
+                        }
+                    }
+                    for( const auto &watcher : directoryWatchers ) {
+                        watcher->watch();
+                    }
+                    next = std::chrono::steady_clock::now() + ms;
+                }
+                
+                // make this thread sleep for a while, only waking up early while some files are expected to change
+                if( coChangePrefetchEnabled() && coChanges().hasFollowers( std::chrono::steady_clock::now() ) ){
+                    std::this_thread::sleep_until( std::min( next, std::chrono::steady_clock::now() + followersMs ) );
+                }
+                else {
+                    std::this_thread::sleep_until( next );
+                }
+            }
+        } ) );
+    }
+    
+    //! Starts the thread replicating the mirrors, the first time a directory gets mirrored. Expects mMirrorsMutex to be locked.
+    void startMirrors()
+    {
+        if( mMirrorThread ){
+            return;
+        }
+        // mirrors walk whole trees and copy files, so they get their own thread and lock and never hold back the watchers
+        mMirrorThread = std::unique_ptr<std::thread>( new std::thread( [this](){
+            auto ms = std::chrono::milliseconds( 1000 );
+            while( mWatching ) {
+                auto next = std::chrono::steady_clock::now() + ms;
+                // unmirror can drop a mirror while it is being updated, it stays alive until the update is done
+                std::vector<std::shared_ptr<Mirror>> mirrors;
+                {
+                    std::lock_guard<std::mutex> lock( mMirrorsMutex );
+                    for( auto it = mMirrors.begin(); it != mMirrors.end(); ++it ) {
+                        mirrors.push_back( it->second );
+                    }
+                }
+                for( const auto &mirror : mirrors ) {
+                    mirror->update();
+                }
+                std::this_thread::sleep_until( next );
+            }
+        } ) );
+    }
+    
+    //! Returns the process instance. In header-only mode this is an inline function's static, which is only shared by the modules the loader merges it across: a single binary or ELF shared libraries with default visibility. Libraries built with -fvisibility=hidden and Windows DLLs each get their own instance and thread.
+    static Impl& get()
+    {
+        // create the static instance
+        static Impl wd;
+        // and start its thread
+        if( !wd.mWatching ) {
+            wd.start();
+            #ifdef CINDER_CINDER
+                #if CINDER_VERSION < 900
+                    ci::app::App::get()->getSignalShutdown().connect( [&]() {
+                #else
+                    ci::app::App::get()->getSignalCleanup().connect( [&]() {
+                #endif
+                        wd.close();
+                    } );
+            #endif
+        }
+        return wd;
+    }
+    
+    static void watchImpl( const ci::fs::path &path, const std::function<void(const ci::fs::path&)> &callback = std::function<void(const ci::fs::path&)>(), const std::function<void(const std::vector<ci::fs::path>&)> &listCallback = std::function<void(const std::vector<ci::fs::path>&)>() )
+    {
+        Impl &wd = get();
+        const std::string key = path.string();
+        
+        // add a new watcher
+        if( callback || listCallback ){
+            
+            std::string filter;
+            ci::fs::path p = path;
+            // try to see if there's a match for the wildcard
+            if( path.string().find( "*" ) != std::string::npos ){
+                bool found = false;
+                std::pair<ci::fs::path,std::string> pathFilter = visitWildCardPath( path, [&found]( const ci::fs::path &p ){
+                    found = true;
+                    return true;
+                } );
+                if( !found ){
+                    throw WatchedFileSystemExc( path );
+                }
+                else {
+                    p       = pathFilter.first;
+                    filter  = pathFilter.second;
+                }
+            }
+            
+#ifdef CINDER_CINDER
+            // try to see if the path is an asset
+            if( !ci::fs::exists( p ) ){
+                ci::fs::path asset = ci::app::getAssetPath( p );
+                if( !asset.empty() ){
+                    p = asset;
+                }
+            }
+            // throw an exception if the file doesn't exist
+            if( !ci::fs::exists( p ) ){
+                throw WatchedFileSystemExc( path );
+            }
+#endif
+            
+            std::lock_guard<std::mutex> lock( wd.mMutex );
+            if( wd.mFileWatchers.find( key ) == wd.mFileWatchers.end() ){
+                auto watcher = wd.mFileWatchers.emplace( make_pair( key, Watcher( p, filter, callback, listCallback ) ) ).first;
+                if( !filter.empty() ){
+                    wd.mDirectories.subscribe( p );
+                }
+                std::lock_guard<std::mutex> versionsLock( wd.mVersionsMutex );
+                wd.mVersions[ key ] = watcher->second.getPublishedVersion();
+            }
+        }
+        // if there is no callback that means that we are unwatching
+        else {
+            // if the path is empty we unwatch all files
+            if( path.empty() ){
+                std::lock_guard<std::mutex> lock( wd.mMutex );
+                for( auto it = wd.mFileWatchers.begin(); it != wd.mFileWatchers.end(); ) {
+                    wd.unsubscribe( it->second );
+                    it = wd.mFileWatchers.erase( it );
+                }
+                std::lock_guard<std::mutex> directoryWatchersLock( wd.mDirectoryWatchersMutex );
+                wd.mDirectoryWatchers.clear();
+                std::lock_guard<std::mutex> versionsLock( wd.mVersionsMutex );
+                wd.mVersions.clear();
+            }
+            // or the specified file or directory
+            else {
+                std::lock_guard<std::mutex> lock( wd.mMutex );
+                auto watcher = wd.mFileWatchers.find( key );
+                if( watcher != wd.mFileWatchers.end() ){
+                    wd.unsubscribe( watcher->second );
+                    wd.mFileWatchers.erase( watcher );
+                }
+                std::lock_guard<std::mutex> directoryWatchersLock( wd.mDirectoryWatchersMutex );
+                wd.mDirectoryWatchers.erase( key );
+                std::lock_guard<std::mutex> versionsLock( wd.mVersionsMutex );
+                wd.mVersions.erase( key );
+            }
+        }
+    }
+    
+    static std::atomic<bool>& gitIndexBootstrapEnabled()
+    {
+        static std::atomic<bool> enabled( false );
+        return enabled;
+    }
+    
+    static std::atomic<bool>& coChangePrefetchEnabled()
+    {
+        static std::atomic<bool> enabled( false );
+        return enabled;
+    }
+    
+    //! Learns which files tend to be modified shortly after each other, and keeps track of the ones that are likely to change next
+    class CoChangeTable {
+    public:
+        //! Starts a new check, a file seen by several watchers during the same check is only recorded once
+        void nextTick()
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            ++mTick;
+        }
+        
+        //! Records a modification of the file with the path id and returns the paths of the files likely to follow
+        std::vector<ci::fs::path> record( uint32_t id )
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            auto now = std::chrono::steady_clock::now();
+            for( const Modification &recent : mRecent ){
+                if( recent.id == id && recent.tick == mTick ){
+                    return std::vector<ci::fs::path>();
+                }
+            }
+            mBoosted.erase( id );
+            
+            // drop the modifications too old to be related to this one
+            while( !mRecent.empty() && ( now - mRecent.front().time > std::chrono::seconds( 2 ) || mRecent.size() >= 64 ) ){
+                mRecent.pop_front();
+            }
+            // count this modification as following each of the recent ones, once per file
+            std::vector<uint32_t> leaders;
+            for( const Modification &recent : mRecent ){
+                if( recent.id != id && std::find( leaders.begin(), leaders.end(), recent.id ) == leaders.end() ){
+                    leaders.push_back( recent.id );
+                    if( mFollowers[ recent.id ][ id ]++ == 0 ){
+                        ++mPairs;
+                    }
+                }
+            }
+            mRecent.push_back( { id, mTick, now } );
+            ++mModifications[ id ];
+            
+            // the table is bounded, when it is full old statistics fade out
+            if( mPairs > 4096 || mModifications.size() > 4096 ){
+                decay();
+            }
+            
+            // files that followed at least half of this file's modifications, and at least twice
+            std::vector<ci::fs::path> followers;
+            auto it = mFollowers.find( id );
+            if( it != mFollowers.end() ){
+                uint32_t modifications = mModifications[ id ];
+                for( auto follower = it->second.begin(); follower != it->second.end(); ++follower ){
+                    if( follower->second >= 2 && follower->second * 2 >= modifications ){
+                        mBoosted[ follower->first ] = now + std::chrono::seconds( 2 );
+                        followers.push_back( pathTable().getPath( follower->first ) );
+                    }
+                }
+            }
+            return followers;
+        }
+        
+        //! Returns whether some files are expected to change soon
+        bool hasFollowers( std::chrono::steady_clock::time_point now )
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            for( auto it = mBoosted.begin(); it != mBoosted.end(); ){
+                it = it->second < now ? mBoosted.erase( it ) : std::next( it );
+            }
+            return !mBoosted.empty();
+        }
+        
+        //! Returns the paths of the files expected to change soon
+        std::vector<ci::fs::path> getFollowers( std::chrono::steady_clock::time_point now )
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            std::vector<ci::fs::path> followers;
+            for( auto it = mBoosted.begin(); it != mBoosted.end(); ){
+                if( it->second < now ){
+                    it = mBoosted.erase( it );
+                }
+                else {
+                    followers.push_back( pathTable().getPath( it->first ) );
+                    ++it;
+                }
+            }
+            return followers;
+        }
+        
+    protected:
+        //! Halves every count and forgets the ones that drop to zero
+        void decay()
+        {
+            mPairs = 0;
+            for( auto leader = mFollowers.begin(); leader != mFollowers.end(); ){
+                for( auto follower = leader->second.begin(); follower != leader->second.end(); ){
+                    follower->second /= 2;
+                    if( follower->second == 0 ){
+                        follower = leader->second.erase( follower );
+                    }
+                    else {
+                        ++mPairs;
+                        ++follower;
+                    }
+                }
+                leader = leader->second.empty() ? mFollowers.erase( leader ) : std::next( leader );
+            }
+            for( auto it = mModifications.begin(); it != mModifications.end(); ){
+                it->second /= 2;
+                it = it->second == 0 ? mModifications.erase( it ) : std::next( it );
+            }
+        }
+        
+        struct Modification {
+            uint32_t                                id;
+            uint64_t                                tick;
+            std::chrono::steady_clock::time_point   time;
+        };
+        
+        std::mutex                                                                  mMutex;
+        std::deque<Modification>                                                    mRecent;
+        std::unordered_map<uint32_t,std::unordered_map<uint32_t,uint32_t>>         mFollowers;
+        std::unordered_map<uint32_t,uint32_t>                                       mModifications;
+        std::map<uint32_t,std::chrono::steady_clock::time_point>                   mBoosted;
+        size_t                                                                      mPairs = 0;
+        uint64_t                                                                    mTick = 0;
+    };
+    
+    static CoChangeTable& coChanges()
+    {
+        static CoChangeTable table;
+        return table;
+    }
+    
+    //! Loads the metadata of a file and asks the os to read its content ahead so it is in the page cache when needed
+    static void prefetch( const ci::fs::path &path )
+    {
+#if defined( __linux__ )
+        int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+        if( fd >= 0 ){
+            ::posix_fadvise( fd, 0, 0, POSIX_FADV_WILLNEED );
+            ::close( fd );
+        }
+#else
+        try {
+            ci::fs::exists( path );
+        }
+        catch( const std::exception & ) {}
+#endif
+    }
+    
+    static std::atomic<bool>& snapshotsEnabled()
+    {
+        static std::atomic<bool> enabled( false );
+        return enabled;
+    }
+    
+    //! Recycles the directories holding the snapshots so taking one doesn't create and remove a directory each time
+    class SnapshotPool {
+    public:
+        ~SnapshotPool()
+        {
+            for( auto it = mRetiredRoots.begin(); it != mRetiredRoots.end(); ++it ){
+                removeRoot( it->first );
+            }
+            removeRoot( mRoot );
+        }
+        
+        void setDirectory( const ci::fs::path &directory )
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            if( directory != mDirectory ){
+                // a callback might still be reading from the current root, it goes away with its last snapshot
+                size_t outstanding = mSlotCount - mFreeSlots.size();
+                if( outstanding ){
+                    mRetiredRoots[mRoot] = outstanding;
+                }
+                else {
+                    removeRoot( mRoot );
+                }
+                mRoot.clear();
+                mFreeSlots.clear();
+                mSlotCount = 0;
+                mDirectory = directory;
+            }
+        }
+        
+        //! Returns a free location for a snapshot of a file named filename
+        ci::fs::path acquire( const ci::fs::path &filename )
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            if( mRoot.empty() ){
+                ci::fs::path directory = mDirectory.empty() ? ci::fs::temp_directory_path() : mDirectory;
+                mRoot = directory / ( "watchdog-snapshots-" + std::to_string( std::chrono::steady_clock::now().time_since_epoch().count() ) );
+            }
+            std::string slot;
+            if( mFreeSlots.empty() ){
+                slot = std::to_string( mSlotCount++ );
+                ci::fs::create_directories( mRoot / slot );
+            }
+            else {
+                slot = mFreeSlots.back();
+                mFreeSlots.pop_back();
+            }
+            return mRoot / slot / filename;
+        }
+        
+        //! Removes a snapshot and gives its slot back to the pool
+        void release( const ci::fs::path &snapshot )
+        {
+            try {
+                ci::fs::remove( snapshot );
+            }
+            catch( const std::exception & ) {}
+            std::lock_guard<std::mutex> lock( mMutex );
+            ci::fs::path root = snapshot.parent_path().parent_path();
+            if( root == mRoot ){
+                mFreeSlots.push_back( snapshot.parent_path().filename().string() );
+            }
+            // the pool might have moved since the snapshot was taken
+            else {
+                auto retired = mRetiredRoots.find( root );
+                if( retired != mRetiredRoots.end() && --retired->second == 0 ){
+                    removeRoot( root );
+                    mRetiredRoots.erase( retired );
+                }
+            }
+        }
+        
+    protected:
+        static void removeRoot( const ci::fs::path &root )
+        {
+            if( !root.empty() ){
+                try {
+                    ci::fs::remove_all( root );
+                }
+                catch( const std::exception & ) {}
+            }
+        }
+        
+        std::mutex                      mMutex;
+        ci::fs::path                    mDirectory;
+        ci::fs::path                    mRoot;
+        std::vector<std::string>        mFreeSlots;
+        size_t                          mSlotCount = 0;
+        //! Roots left behind by setDirectory, with the number of their snapshots still in use
+        std::map<ci::fs::path,size_t>   mRetiredRoots;
+    };
+    
+    static SnapshotPool& snapshotPool()
+    {
+        static SnapshotPool pool;
+        return pool;
+    }
+    
+    //! Returns a stamp identifying the current version of a file, with sub-second precision where the platform provides it
+    static std::string fileStamp( const ci::fs::path &path )
+    {
+#if defined( __linux__ )
+        struct stat st;
+        if( ::stat( path.c_str(), &st ) != 0 ){
+            throw WatchedFileSystemExc( path );
+        }
+        return std::to_string( st.st_size ) + ":" + std::to_string( st.st_mtim.tv_sec ) + "." + std::to_string( st.st_mtim.tv_nsec ) + ":" + std::to_string( st.st_ctim.tv_sec ) + "." + std::to_string( st.st_ctim.tv_nsec );
+#elif defined( CINDER_WINRT ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1900 ) )
+        return std::to_string( ci::fs::file_size( path ) ) + ":" + std::to_string( ci::fs::last_write_time( path ).time_since_epoch().count() );
+#else
+        return std::to_string( ci::fs::file_size( path ) ) + ":" + std::to_string( ci::fs::last_write_time( path ) );
+#endif
+    }
+    
+    //! Copies a file to the snapshot pool, retrying if its size or write times change during the copy. Returns an empty path if it kept changing. A writer idle during the whole copy isn't noticed, even if it hasn't finished writing.
+    static ci::fs::path takeSnapshot( const ci::fs::path &path )
+    {
+        SnapshotPool &pool = snapshotPool();
+        for( int attempt = 0; attempt < 3; ++attempt ){
+            ci::fs::path snapshot;
+            try {
+                std::string stamp = fileStamp( path );
+                snapshot = pool.acquire( path.filename() );
+                cloneFile( path, snapshot );
+                if( fileStamp( path ) == stamp ){
+                    return snapshot;
+                }
+            }
+            catch( const std::exception & ) {}
+            if( !snapshot.empty() ){
+                pool.release( snapshot );
+            }
+        }
+        return ci::fs::path();
+    }
+    
+    //! What the git index recorded about a file the last time it was refreshed
+    struct GitIndexEntry {
+        std::time_t mTime;
+        uint32_t    mTimeNsec;
+        uint32_t    mSize;
+    };
+    
+    //! Parses the content of a git index (versions 2 to 4), indexed by path relative to the work tree. Racy entries (written in the same second as the index or later), unmerged, skip-worktree, intent-to-add and non regular file entries are left out so they get stat'ed instead.
+    static std::map<std::string,GitIndexEntry> parseGitIndex( const std::string &data, std::time_t indexTime )
+    {
+        std::map<std::string,GitIndexEntry> entries;
+        
+        auto byte   = [&data]( size_t offset ) -> uint32_t { return static_cast<unsigned char>( data[offset] ); };
+        auto read16 = [&byte]( size_t offset ) -> uint32_t { return ( byte( offset ) << 8 ) | byte( offset + 1 ); };
+        auto read32 = [&read16]( size_t offset ) -> uint32_t { return ( read16( offset ) << 16 ) | read16( offset + 2 ); };
+        
+        if( data.size() < 12 || data.compare( 0, 4, "DIRC" ) != 0 ){
+            return entries;
+        }
+        uint32_t version    = read32( 4 );
+        uint32_t count      = read32( 8 );
+        if( version < 2 || version > 4 ){
+            return entries;
+        }
+        
+        size_t offset = 12;
+        std::string name;
+        for( uint32_t i = 0; i < count; ++i ){
+            size_t entryStart = offset;
+            if( offset + 62 > data.size() ) break;
+            
+            // ctime, mtime, dev, ino, mode, uid, gid, size, sha1 and flags
+            GitIndexEntry entry;
+            entry.mTime         = read32( offset + 8 );
+            entry.mTimeNsec     = read32( offset + 12 );
+            entry.mSize         = read32( offset + 36 );
+            uint32_t mode       = read32( offset + 24 );
+            uint32_t flags      = read16( offset + 60 );
+            offset += 62;
+            
+            bool skip = ( mode >> 12 ) != 010 || ( flags & 0x3000 ) != 0 || entry.mTime >= indexTime;
+            if( version >= 3 && ( flags & 0x4000 ) ){
+                if( offset + 2 > data.size() ) break;
+                skip = skip || ( read16( offset ) & 0x6000 ) != 0;
+                offset += 2;
+            }
+            
+            if( version == 4 ){
+                // v4 paths are prefix compressed: a varint tells how much of the previous path to drop
+                if( offset >= data.size() ) break;
+                uint32_t c      = byte( offset++ );
+                size_t strip    = c & 127;
+                while( ( c & 128 ) && offset < data.size() ){
+                    c       = byte( offset++ );
+                    strip   = ( ( strip + 1 ) << 7 ) | ( c & 127 );
+                }
+                size_t end = data.find( '\0', offset );
+                if( end == std::string::npos || strip > name.size() ) break;
+                name.erase( name.size() - strip );
+                name.append( data, offset, end - offset );
+                offset = end + 1;
+            }
+            else {
+                // v2 and v3 entries are padded with 1 to 8 nul bytes to a multiple of 8
+                size_t end = data.find( '\0', offset );
+                if( end == std::string::npos ) break;
+                name.assign( data, offset, end - offset );
+                offset = entryStart + ( ( end - entryStart + 8 ) & ~static_cast<size_t>( 7 ) );
+            }
+            
+            if( !skip ){
+                entries[name] = entry;
+            }
+        }
+        
+        return entries;
+    }
+    
+    //! Returns the git index entries of the regular files directly inside directory, indexed by file name. The parsed index is cached per git directory and only read again when the index itself changes.
+    static std::map<std::string,GitIndexEntry> readGitIndex( const ci::fs::path &directory )
+    {
+        std::map<std::string,GitIndexEntry> entries;
+        
+        // find the closest work tree containing the directory
+        ci::fs::path dir = ci::fs::canonical( directory );
+        ci::fs::path root, gitDir;
+        for( ci::fs::path p = dir; !p.empty(); p = p.parent_path() ){
+            if( ci::fs::exists( p / ".git" ) ){
+                root    = p;
+                gitDir  = p / ".git";
+                break;
+            }
+            if( p == p.root_path() ) break;
+        }
+        if( root.empty() ){
+            return entries;
+        }
+        
+        // worktrees and submodules have a .git file pointing to the actual git directory
+        if( ci::fs::is_regular_file( gitDir ) ){
+            std::ifstream gitFile( gitDir.string() );
+            std::string line;
+            std::getline( gitFile, line );
+            if( line.compare( 0, 8, "gitdir: " ) != 0 ){
+                return entries;
+            }
+            ci::fs::path target = line.substr( 8 );
+            gitDir = target.is_absolute() ? target : root / target;
+        }
+        
+        ci::fs::path indexPath = gitDir / "index";
+        if( !ci::fs::is_regular_file( indexPath ) ){
+            return entries;
+        }
+#if defined( CINDER_WINRT ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1900 ) )
+        std::time_t indexTime = ci::fs::file_time_type::clock::to_time_t( ci::fs::last_write_time( indexPath ) );
+#else
+        std::time_t indexTime = ci::fs::last_write_time( indexPath );
+#endif
+        uintmax_t indexSize = ci::fs::file_size( indexPath );
+        
+        // several watchers in the same work tree share the parsed index until git rewrites it
+        struct CachedIndex {
+            std::time_t                                             mTime;
+            uintmax_t                                               mSize;
+            std::shared_ptr<const std::map<std::string,GitIndexEntry>> mEntries;
+        };
+        static std::mutex cacheMutex;
+        static std::map<std::string,CachedIndex> cache;
+        std::shared_ptr<const std::map<std::string,GitIndexEntry>> index;
+        {
+            std::lock_guard<std::mutex> lock( cacheMutex );
+            auto cached = cache.find( indexPath.string() );
+            if( cached != cache.end() && cached->second.mTime == indexTime && cached->second.mSize == indexSize ){
+                index = cached->second.mEntries;
+            }
+        }
+        if( !index ){
+            std::ifstream indexFile( indexPath.string(), std::ios::binary );
+            std::string data( ( std::istreambuf_iterator<char>( indexFile ) ), std::istreambuf_iterator<char>() );
+            index = std::make_shared<const std::map<std::string,GitIndexEntry>>( parseGitIndex( data, indexTime ) );
+            std::lock_guard<std::mutex> lock( cacheMutex );
+            cache[indexPath.string()] = { indexTime, indexSize, index };
+        }
+        
+        // git paths are relative to the work tree and always use forward slashes
+        std::string prefix = dir.generic_string().substr( root.generic_string().size() );
+        if( !prefix.empty() && prefix[0] == '/' ) prefix.erase( 0, 1 );
+        if( !prefix.empty() ) prefix += '/';
+        
+        // the index is sorted by path so the directory's files are contiguous
+        for( auto it = index->lower_bound( prefix ); it != index->end() && it->first.compare( 0, prefix.size(), prefix ) == 0; ++it ){
+            if( it->first.find( '/', prefix.size() ) == std::string::npos ){
+                entries[ it->first.substr( prefix.size() ) ] = it->second;
+            }
+        }
+        
+        return entries;
+    }
+    
+    //! Copies a file, sharing its extents with a reflink on filesystems that support it and copying inside the kernel with copy_file_range otherwise. Falls back to a regular copy on other platforms. The copy is written next to the target and renamed over it, so readers of the target never see a truncated or half written file.
+    static void cloneFile( const ci::fs::path &from, const ci::fs::path &to )
+    {
+        ci::fs::path temporary = to.parent_path() / ( "." + to.filename().string() + ".watchdog-tmp" );
+#if defined( __linux__ )
+        bool cloned = false;
+        int in = ::open( from.c_str(), O_RDONLY | O_CLOEXEC );
+        struct stat st;
+        if( in >= 0 && ::fstat( in, &st ) == 0 ){
+            int out = ::open( temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777 );
+            if( out >= 0 ){
+    #if defined( FICLONE )
+                cloned = ::ioctl( out, FICLONE, in ) == 0;
+    #endif
+    #if defined( __GLIBC__ )
+        #if __GLIBC_PREREQ( 2, 27 )
+                if( !cloned ){
+                    off_t remaining = st.st_size;
+                    while( remaining > 0 ){
+                        ssize_t copied = ::copy_file_range( in, nullptr, out, nullptr, remaining, 0 );
+                        if( copied <= 0 ) break;
+                        remaining -= copied;
+                    }
+                    cloned = remaining == 0;
+                }
+        #endif
+    #endif
+                ::close( out );
+            }
+        }
+        if( in >= 0 ){
+            ::close( in );
+        }
+        if( !cloned )
+#endif
+        {
+            // copy_file doesn't overwrite by default and the option to do so differs between filesystem implementations
+            ci::fs::remove( temporary );
+            try {
+                ci::fs::copy_file( from, temporary );
+            }
+            catch( ... ) {
+                ci::fs::remove( temporary );
+                throw;
+            }
+        }
+        ci::fs::rename( temporary, to );
+    }
+    
+    static std::pair<ci::fs::path,std::string> getPathFilterPair( const ci::fs::path &path )
+    {
+        // extract wildcard and parent path
+        std::string key     = path.string();
+        ci::fs::path p      = path;
+        size_t wildCardPos  = key.find( "*" );
+        std::string filter;
+        if( wildCardPos != std::string::npos ){
+            filter  = path.filename().string();
+            p       = path.parent_path();
+        }
+        
+#ifdef CINDER_CINDER
+        // try to see if the path is an asset
+        if( !ci::fs::exists( p ) ){
+            ci::fs::path asset = ci::app::getAssetPath( p );
+            if( !asset.empty() ){
+                p = asset;
+            }
+        }
+#endif
+        // throw an exception if the file doesn't exist
+        if( filter.empty() && !ci::fs::exists( p ) ){
+            throw WatchedFileSystemExc( path );
+        }
+#ifdef CINDER_CINDER
+        else if( !filter.empty() && p.empty() ) {
+            // at this stage if the parent directory doesn't exist the only option left is to try with the asset folder
+            p = ci::app::getAssetPath( "" );
+        }
+#endif
+        
+        return std::make_pair( p, filter );
+            
+    }
+    
+    static std::pair<ci::fs::path,std::string> visitWildCardPath( const ci::fs::path &path, const std::function<bool(const ci::fs::path&)> &visitor ){
+        std::pair<ci::fs::path, std::string> pathFilter = getPathFilterPair( path );
+        if( !pathFilter.second.empty() ){
+            std::string full    = ( pathFilter.first / pathFilter.second ).string();
+            ci::fs::directory_iterator end;
+            for( ci::fs::directory_iterator it( pathFilter.first ); it != end; ++it ){
+                if( matchWildCard( full, it->path().string() ) ){
+                    if( visitor( it->path() ) ){
+                        break;
+                    }
+                }
+            }
+        }
+        return pathFilter;
+    }
+    
+    //! Returns whether path matches the wildcard path
+    static bool matchWildCard( const std::string &wildCardPath, const std::string &path )
+    {
+        size_t wildcardPos  = wildCardPath.find( "*" );
+        std::string before  = wildCardPath.substr( 0, wildcardPos );
+        std::string after   = wildCardPath.substr( wildcardPos + 1 );
+        size_t beforePos    = path.find( before );
+        size_t afterPos     = path.find( after );
+        return ( beforePos != std::string::npos || before.empty() )
+            && ( afterPos != std::string::npos || after.empty() );
+    }
+    
+    //! Lists and stats the watched directories once per check and shares the result between all the watchers of the same directory. Directories are reference counted by the watchers subscribed to them.
+    class DirectoryRegistry {
+    public:
+        //! A listed directory entry. Its write time is only read the first time a watcher matches it, then shared until the next update.
+        struct Entry {
+            explicit Entry( const ci::fs::path &p )
+            : path(p), stated(false), exists(false)
+            {
+            }
+            
+            //! Returns false if the entry was removed since it was listed
+            bool getLastWriteTime( FileTime *t ) const
+            {
+                if( !stated ){
+                    stated = true;
+                    try {
+                        time    = ci::fs::last_write_time( path );
+                        exists  = true;
+                    }
+                    catch( const std::exception & ) {}
+                }
+                *t = time;
+                return exists;
+            }
+            
+            ci::fs::path        path;
+            
+        protected:
+            mutable FileTime    time;
+            mutable bool        stated;
+            mutable bool        exists;
+        };
+        
+        void subscribe( const ci::fs::path &directory )
+        {
+            Directory &dir = mDirectories[ directory.string() ];
+            dir.path = directory;
+            ++dir.subscriptions;
+        }
+        
+        void unsubscribe( const ci::fs::path &directory )
+        {
+            auto it = mDirectories.find( directory.string() );
+            if( it != mDirectories.end() && --it->second.subscriptions == 0 ){
+                mDirectories.erase( it );
+            }
+        }
+        
+        //! Lists each subscribed directory, without reading anything about the entries yet
+        void update()
+        {
+            for( auto it = mDirectories.begin(); it != mDirectories.end(); ++it ){
+                Directory &dir = it->second;
+                dir.entries.clear();
+                try {
+                    ci::fs::directory_iterator end;
+                    for( ci::fs::directory_iterator entry( dir.path ); entry != end; ++entry ){
+                        dir.entries.push_back( Entry( entry->path() ) );
+                    }
+                }
+                catch( const std::exception & ) {}
+            }
+        }
+        
+        //! Returns the entries listed during the last update
+        const std::vector<Entry>& getEntries( const ci::fs::path &directory ) const
+        {
+            static const std::vector<Entry> empty;
+            auto it = mDirectories.find( directory.string() );
+            return it != mDirectories.end() ? it->second.entries : empty;
+        }
+        
+    protected:
+        struct Directory {
+            Directory() : subscriptions(0) {}
+            ci::fs::path        path;
+            size_t              subscriptions;
+            std::vector<Entry>  entries;
+        };
+        
+        std::map<std::string,Directory> mDirectories;
+    };
+    
+    //! Interns paths as small ids. Interning is serialized, but the paths are never moved or removed once interned so lookups don't take any lock and never wait for a watcher.
+    class PathTable {
+    public:
+        PathTable()
+        : mCount(0), mIndex(new Index(1024))
+        {
+            for( auto &chunk : mChunks ){
+                chunk = nullptr;
+            }
+        }
+        
+        ~PathTable()
+        {
+            for( auto &chunk : mChunks ){
+                delete [] chunk.load();
+            }
+            delete mIndex.load();
+            for( Index *index : mRetiredIndices ){
+                delete index;
+            }
+        }
+        
+        uint32_t intern( const std::string &path )
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            uint32_t id;
+            if( find( path, &id ) ){
+                return id;
+            }
+            
+            // fill the path before publishing its id
+            id = mCount++;
+            size_t chunk, offset;
+            locate( id, &chunk, &offset );
+            std::string *paths = mChunks[chunk].load( std::memory_order_relaxed );
+            if( !paths ){
+                paths = new std::string[ chunkSize( chunk ) ];
+                mChunks[chunk].store( paths, std::memory_order_release );
+            }
+            paths[offset] = path;
+            
+            // keep the index at most half full, readers still using the previous one can finish with it
+            Index *index = mIndex.load( std::memory_order_relaxed );
+            if( mCount * 2 > index->mSize ){
+                Index *grown = new Index( index->mSize * 2 );
+                for( uint32_t i = 0; i < mCount; ++i ){
+                    insert( grown, i );
+                }
+                mIndex.store( grown, std::memory_order_release );
+                mRetiredIndices.push_back( index );
+            }
+            else {
+                insert( index, id );
+            }
+            return id;
+        }
+        
+        //! Looks up the id of a path without interning it. Returns false if the path is unknown.
+        bool find( const std::string &path, uint32_t *id ) const
+        {
+            const Index *index = mIndex.load( std::memory_order_acquire );
+            size_t mask = index->mSize - 1;
+            for( size_t i = std::hash<std::string>()( path ) & mask;; i = ( i + 1 ) & mask ){
+                uint32_t slot = index->mSlots[i].load( std::memory_order_acquire );
+                if( slot == 0 ){
+                    return false;
+                }
+                if( getPath( slot - 1 ) == path ){
+                    *id = slot - 1;
+                    return true;
+                }
+            }
+        }
+        
+        const std::string& getPath( uint32_t id ) const
+        {
+            size_t chunk, offset;
+            locate( id, &chunk, &offset );
+            return mChunks[chunk].load( std::memory_order_acquire )[offset];
+        }
+        
+    protected:
+        //! Open addressing table of ids + 1, 0 marks an empty slot
+        struct Index {
+            explicit Index( size_t size )
+            : mSize(size), mSlots(new std::atomic<uint32_t>[size])
+            {
+                for( size_t i = 0; i < size; ++i ){
+                    mSlots[i] = 0;
+                }
+            }
+            
+            size_t                                      mSize;
+            std::unique_ptr<std::atomic<uint32_t>[]>    mSlots;
+        };
+        
+        void insert( Index *index, uint32_t id )
+        {
+            size_t mask = index->mSize - 1;
+            size_t i = std::hash<std::string>()( getPath( id ) ) & mask;
+            while( index->mSlots[i].load( std::memory_order_relaxed ) != 0 ){
+                i = ( i + 1 ) & mask;
+            }
+            index->mSlots[i].store( id + 1, std::memory_order_release );
+        }
+        
+        //! Chunks double in size so they never have to move: chunk k holds 1024 << k paths
+        static size_t chunkSize( size_t chunk )
+        {
+            return static_cast<size_t>( 1024 ) << chunk;
+        }
+        
+        static void locate( uint32_t id, size_t *chunk, size_t *offset )
+        {
+            uint64_t position = ( static_cast<uint64_t>( id ) >> 10 ) + 1;
+            size_t k = 0;
+            while( position >>= 1 ){
+                ++k;
+            }
+            *chunk  = k;
+            *offset = id - ( ( static_cast<uint64_t>( 1024 ) << k ) - 1024 );
+        }
+        
+        std::mutex                      mMutex;
+        uint32_t                        mCount;
+        std::atomic<std::string*>       mChunks[23];
+        std::atomic<Index*>             mIndex;
+        std::vector<Index*>             mRetiredIndices;
+    };
+    
+    static PathTable& pathTable()
+    {
+        static PathTable table;
+        return table;
+    }
+    
+    //! Latest version of a watcher, shared between the watcher and getVersion
+    struct PublishedVersion {
+        std::mutex  mMutex;
+        Version     mVersion;
+    };
+    
+    class Watcher {
+    public:
+        Watcher( const ci::fs::path &path, const std::string &filter, const std::function<void(const ci::fs::path&)> &callback, const std::function<void(const std::vector<ci::fs::path>&)> &listCallback )
+        : mPath(path), mFilter(filter), mCallback(callback), mListCallback(listCallback), mVersionNumber(0), mPublished(std::make_shared<PublishedVersion>())
+        {
+            // make sure we store all initial write time
+            if( !mFilter.empty() ) {
+                // the git index already knows most of them, only stat the ones it doesn't. the index is only as fresh as the last git command that
+                // refreshed it, a file edited since then starts with its indexed time and gets reported by the first regular check
+                std::map<std::string,GitIndexEntry> indexEntries;
+                if( gitIndexBootstrapEnabled() ){
+                    indexEntries = readGitIndex( mPath );
+                }
+                std::vector<ci::fs::path> paths;
+                visitWildCardPath( path / filter, [this,&paths,&indexEntries]( const ci::fs::path &p ){
+                    auto indexed = indexEntries.find( p.filename().string() );
+                    if( indexed != indexEntries.end() ){
+#if defined( CINDER_WINRT ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1900 ) )
+                        mModificationTimes.insert( pathTable().intern( p.string() ), ci::fs::file_time_type::clock::from_time_t( indexed->second.mTime ) );
+#else
+                        mModificationTimes.insert( pathTable().intern( p.string() ), indexed->second.mTime );
+#endif
+                        ++mVersionNumber;
+                    }
+                    else {
+                        hasChanged( p );
+                    }
+                    paths.push_back( p );
+                    return false;
+                } );
+                publish();
+                // this means that the first watch won't call the callback function
+                // so we have to manually call it here
+                // without snapshots, copying every matched file while holding the watchers lock would stall every other watcher
+                if( mCallback ){
+                    mCallback( mPath / mFilter );
+                }
+                else {
+                    mListCallback( paths );
+                }
+            }
+        }
+        
+        void watch( const DirectoryRegistry &directories )
+        {
+            // if there's no filter we just check for one item
+            bool initial = mVersionNumber == 0;
+            if( mFilter.empty() && hasChanged( mPath ) && mCallback ){
+                ci::fs::path path = mPath;
+                // like the wildcard watchers, the initial callback receives the file itself
+                if( snapshotsEnabled() && !initial && ci::fs::is_regular_file( mPath ) ){
+                    path = takeSnapshot( mPath );
+                    // the file is still being written, report it again on the next check
+                    if( path.empty() ){
+                        forget( mPath );
+                        return;
+                    }
+                }
+                publish();
+#ifdef CINDER_CINDER
+                ci::app::App::get()->dispatchAsync( [this,path](){
+                    mCallback( path );
+                    if( path != mPath ) snapshotPool().release( path );
+                } );
+#else
+                mCallback( path );
+                if( path != mPath ) snapshotPool().release( path );
+                //#error TODO: still have to figure out an elegant way to do this without cinder
+#endif
+            }
+            // otherwise we check the whole parent directory
+            else if( !mFilter.empty() ){
+                
+                std::vector<ci::fs::path> paths;
+                const std::string wildCardPath = ( mPath / mFilter ).string();
+                for( const DirectoryRegistry::Entry &entry : directories.getEntries( mPath ) ){
+                    if( !matchWildCard( wildCardPath, entry.path.string() ) ){
+                        continue;
+                    }
+                    FileTime time;
+                    if( !entry.getLastWriteTime( &time ) ){
+                        continue;
+                    }
+                    bool pathHasChanged = hasChanged( entry.path, time );
+                    if( pathHasChanged && mCallback ){
+                        publish();
+#ifdef CINDER_CINDER
+                        ci::app::App::get()->dispatchAsync( [this](){
+                            mCallback( mPath / mFilter );
+                        } );
+#else
+                        mCallback( mPath / mFilter );
+                        //#error TODO: still have to figure out an elegant way to do this without cinder
+#endif
+                        break;
+                    }
+                    else if( pathHasChanged && mListCallback ){
+                        paths.push_back( entry.path );
+                    }
+                }
+                if( paths.size() && mListCallback ){
+                    notifyList( paths );
+                }
+            }
+            
+            publish();
+        }
+        
+        //! Checks a single file this watcher might be watching, between two regular checks
+        void watch( const ci::fs::path &path )
+        {
+            if( mFilter.empty() ){
+                if( path == mPath ){
+                    watch( DirectoryRegistry() );
+                }
+                return;
+            }
+            if( path.parent_path() != mPath || !matchWildCard( ( mPath / mFilter ).string(), path.string() ) ){
+                return;
+            }
+            
+            FileTime time;
+            try {
+                time = ci::fs::last_write_time( path );
+            }
+            catch( const std::exception & ) {
+                return;
+            }
+            if( hasChanged( path, time ) ){
+                if( mCallback ){
+                    publish();
+#ifdef CINDER_CINDER
+                    ci::app::App::get()->dispatchAsync( [this](){
+                        mCallback( mPath / mFilter );
+                    } );
+#else
+                    mCallback( mPath / mFilter );
+#endif
+                }
+                else if( mListCallback ){
+                    notifyList( std::vector<ci::fs::path>( 1, path ) );
+                }
+                publish();
+            }
+        }
+        
+        const ci::fs::path& getPath() const { return mPath; }
+        const std::string& getFilter() const { return mFilter; }
+        
+        //! Returns the latest version published by this watcher
+        std::shared_ptr<PublishedVersion> getPublishedVersion() const { return mPublished; }
+        
+        //! Calls the list callback, with snapshots of the files instead of the files themselves when they are enabled
+        void notifyList( const std::vector<ci::fs::path> &paths )
+        {
+            if( !snapshotsEnabled() ){
+                publish();
+                mListCallback( paths );
+                return;
+            }
+            
+            std::vector<ci::fs::path> files, snapshots;
+            for( const ci::fs::path &p : paths ){
+                if( !ci::fs::is_regular_file( p ) ){
+                    files.push_back( p );
+                    continue;
+                }
+                ci::fs::path snapshot = takeSnapshot( p );
+                if( !snapshot.empty() ){
+                    files.push_back( snapshot );
+                    snapshots.push_back( snapshot );
+                }
+                // the file is still being written, report it again on the next check
+                else {
+                    forget( p );
+                }
+            }
+            publish();
+            if( files.size() ){
+                mListCallback( files );
+            }
+            for( const ci::fs::path &snapshot : snapshots ){
+                snapshotPool().release( snapshot );
+            }
+        }
+
+		bool hasChanged( const ci::fs::path &path )
+        {
+            // get the last modification time
+            return hasChanged( path, ci::fs::last_write_time( path ) );
+        }
+        
+        bool hasChanged( const ci::fs::path &path, FileTime time )
+        {
+            // add a new modification time to the map
+            uint32_t key = pathTable().intern( path.string() );
+            const FileTime *prev = mModificationTimes.find( key );
+            if( !prev ) {
+                mModificationTimes.insert( key, time );
+                ++mVersionNumber;
+                return true;
+            }
+            // or compare with an older one
+            if( *prev < time ) {
+                mModificationTimes.insert( key, time );
+                ++mVersionNumber;
+                // warm up the files that usually change after this one
+                if( coChangePrefetchEnabled() ){
+                    for( const ci::fs::path &follower : coChanges().record( key ) ){
+                        prefetch( follower );
+                    }
+                }
+                return true;
+            }
+            return false;
+        };
+        
+        //! Drops the recorded modification time of path so its next check reports it as changed
+        void forget( const ci::fs::path &path )
+        {
+            uint32_t key;
+            if( pathTable().find( path.string(), &key ) && mModificationTimes.find( key ) ){
+                mModificationTimes.erase( key );
+                ++mVersionNumber;
+            }
+        }
+        
+        //! Makes the current modification times visible to getVersion. Only the root of the map is copied.
+        void publish()
+        {
+            std::lock_guard<std::mutex> lock( mPublished->mMutex );
+            if( mPublished->mVersion.getNumber() != mVersionNumber ){
+                mPublished->mVersion = Version( std::make_shared<Version::Data>( mModificationTimes, mVersionNumber ) );
+            }
+        }
+        
+    protected:
+        ci::fs::path                                            mPath;
+        std::string                                             mFilter;
+        std::function<void(const ci::fs::path&)>                mCallback;
+        std::function<void(const std::vector<ci::fs::path>&)>   mListCallback;
+        PersistentMap<FileTime>                                 mModificationTimes;
+        uint64_t                                                mVersionNumber;
+        std::shared_ptr<PublishedVersion>                       mPublished;
+    };
+    
+    //! A file or directory found by scanTree
+    struct TreeEntry {
+        //! Returns whether the file was written to since other was scanned. Two writes in the same second are told apart by the nanoseconds.
+        bool isModifiedSince( const TreeEntry &other ) const
+        {
+            return size != other.size || time != other.time || timeNsec != other.timeNsec;
+        }
+        
+        FileTime                time;
+        //! Sub-second part of time where the platform keeps it apart from time, 0 otherwise
+        long                    timeNsec;
+        uintmax_t               size;
+        uintmax_t               inode;
+        bool                    directory;
+    };
+    
+    //! Lists every file and directory below root indexed by their generic path relative to root. Returns false if the listing is incomplete.
+    static bool scanTree( const ci::fs::path &root, std::map<std::string,TreeEntry> &entries )
+    {
+        const size_t rootLength = root.generic_string().size() + 1;
+        try {
+            ci::fs::recursive_directory_iterator end;
+            for( ci::fs::recursive_directory_iterator it( root ); it != end; ++it ){
+                TreeEntry entry;
+#if !defined( _WIN32 )
+                // a single stat gives us everything we need
+                struct stat st;
+                if( ::stat( it->path().c_str(), &st ) != 0 ) continue;
+                entry.time      = st.st_mtime;
+    #if defined( __APPLE__ )
+                entry.timeNsec  = st.st_mtimespec.tv_nsec;
+    #else
+                entry.timeNsec  = st.st_mtim.tv_nsec;
+    #endif
+                entry.size      = S_ISDIR( st.st_mode ) ? 0 : st.st_size;
+                entry.inode     = st.st_ino;
+                entry.directory = S_ISDIR( st.st_mode );
+#else
+                entry.directory = ci::fs::is_directory( it->path() );
+                entry.time      = ci::fs::last_write_time( it->path() );
+                entry.timeNsec  = 0;
+                entry.size      = entry.directory ? 0 : ci::fs::file_size( it->path() );
+                entry.inode     = 0;
+#endif
+                entries[ it->path().generic_string().substr( rootLength ) ] = entry;
+            }
+        }
+        // the tree can change while we walk it
+        catch( const std::exception & ) {
+            return false;
+        }
+        return true;
+    }
+    
+    class Mirror {
+    public:
+        Mirror( const ci::fs::path &source, const ci::fs::path &target )
+        : mSource(source), mTarget(target)
+        {
+            // a single reconciliation pass between the two directories, afterward only the changes are replicated
+            ci::fs::create_directories( mTarget );
+            if( !scanTree( mSource, mEntries ) ){
+                throw WatchedFileSystemExc( mSource );
+            }
+            // if the target can't be fully listed we just end up copying more than needed
+            std::map<std::string,TreeEntry> targetEntries;
+            scanTree( mTarget, targetEntries );
+            
+            // remove what doesn't exist in source anymore, children first
+            for( auto it = targetEntries.rbegin(); it != targetEntries.rend(); ++it ){
+                auto entry = mEntries.find( it->first );
+                if( entry == mEntries.end() || entry->second.directory != it->second.directory ){
+                    remove( it->first );
+                }
+            }
+            // and copy what is missing or out of date
+            for( auto it = mEntries.begin(); it != mEntries.end(); ){
+                auto entry = targetEntries.find( it->first );
+                bool upToDate = entry != targetEntries.end() && entry->second.directory == it->second.directory
+                    && ( it->second.directory || !it->second.isModifiedSince( entry->second ) );
+                if( upToDate || copy( it->first, it->second ) ){
+                    ++it;
+                }
+                // forget the failed ones so they get retried on the next update
+                else {
+                    it = mEntries.erase( it );
+                }
+            }
+        }
+        
+        void update()
+        {
+            // an incomplete listing would look like deletions, wait for the next update instead
+            std::map<std::string,TreeEntry> entries;
+            if( !scanTree( mSource, entries ) ){
+                return;
+            }
+            
+            // collect what disappeared, indexed by inode to recognize renames
+            std::map<std::string,TreeEntry> removed;
+            std::map<uintmax_t,std::string> removedInodes;
+            for( auto it = mEntries.begin(); it != mEntries.end(); ++it ){
+                auto entry = entries.find( it->first );
+                if( entry == entries.end() || entry->second.directory != it->second.directory ){
+                    removed.insert( *it );
+                    if( it->second.inode ){
+                        removedInodes[ it->second.inode ] = it->first;
+                    }
+                }
+            }
+            
+            // replicate creations, renames and modifications, parents first
+            for( auto it = entries.begin(); it != entries.end(); ){
+                auto previous = mEntries.find( it->first );
+                bool created = previous == mEntries.end() || previous->second.directory != it->second.directory;
+                bool modified = !created && !it->second.directory && it->second.isModifiedSince( previous->second );
+                bool replicated = true;
+                if( created ){
+                    auto renamed = it->second.inode ? removedInodes.find( it->second.inode ) : removedInodes.end();
+                    if( renamed != removedInodes.end() && removed[ renamed->second ].directory == it->second.directory ){
+                        const TreeEntry &before = removed[ renamed->second ];
+                        replicated = rename( renamed->second, it->first );
+                        modified = replicated && !it->second.directory && it->second.isModifiedSince( before );
+                        removed.erase( renamed->second );
+                        removedInodes.erase( renamed );
+                    }
+                    else {
+                        replicated = copy( it->first, it->second );
+                    }
+                }
+                if( modified ){
+                    replicated = copy( it->first, it->second );
+                }
+                // forget the failed ones so they get retried on the next update
+                if( replicated ){
+                    ++it;
+                }
+                else {
+                    it = entries.erase( it );
+                }
+            }
+            
+            // and finally the deletions, children first
+            for( auto it = removed.rbegin(); it != removed.rend(); ++it ){
+                remove( it->first );
+            }
+            
+            mEntries.swap( entries );
+        }
+        
+    protected:
+        bool copy( const std::string &relative, const TreeEntry &entry )
+        {
+            try {
+                ci::fs::path target = mTarget / relative;
+                if( entry.directory ){
+                    if( ci::fs::exists( target ) && !ci::fs::is_directory( target ) ){
+                        ci::fs::remove( target );
+                    }
+                    ci::fs::create_directories( target );
+                }
+                else {
+                    if( ci::fs::is_directory( target ) ){
+                        ci::fs::remove_all( target );
+                    }
+                    cloneFile( mSource / relative, target );
+                    // keep the write times in sync, down to the nanosecond, so the next reconciliation can trust them
+#if !defined( _WIN32 )
+                    struct timespec times[2];
+                    times[0].tv_sec     = 0;
+                    times[0].tv_nsec    = UTIME_OMIT;
+                    times[1].tv_sec     = entry.time;
+                    times[1].tv_nsec    = entry.timeNsec;
+                    if( ::utimensat( AT_FDCWD, target.c_str(), times, 0 ) != 0 ){
+                        return false;
+                    }
+#else
+                    ci::fs::last_write_time( target, entry.time );
+#endif
+                }
+                return true;
+            }
+            catch( const std::exception & ) {
+                return false;
+            }
+        }
+        
+        bool rename( const std::string &from, const std::string &to )
+        {
+            try {
+                // the entry might already have moved with its parent directory
+                if( ci::fs::exists( mTarget / from ) ){
+                    ci::fs::rename( mTarget / from, mTarget / to );
+                }
+                return ci::fs::exists( mTarget / to );
+            }
+            catch( const std::exception & ) {
+                return false;
+            }
+        }
+        
+        void remove( const std::string &relative )
+        {
+            try {
+                ci::fs::remove_all( mTarget / relative );
+            }
+            catch( const std::exception & ) {}
+        }
+        
+        ci::fs::path                    mSource;
+        ci::fs::path                    mTarget;
+        std::map<std::string,TreeEntry>     mEntries;
+    };
+    
+    //! Watches a directory tree and summarizes its changes per directory, the changed paths are never collected
+    class DirectoryWatcher {
+    public:
+        DirectoryWatcher( const ci::fs::path &path, size_t depth, const std::function<void(const std::vector<DirectorySummary>&)> &callback )
+        : mPath(path), mDepth(depth), mCallback(callback)
+        {
+            if( !scanTree( mPath, mEntries ) ){
+                throw WatchedFileSystemExc( mPath );
+            }
+        }
+        
+        void watch()
+        {
+            // an incomplete listing would look like deletions, wait for the next check instead
+            std::map<std::string,TreeEntry> entries;
+            if( !scanTree( mPath, entries ) ){
+                return;
+            }
+            
+            // both listings are sorted so a single pass finds every creation, modification and deletion
+            std::map<std::string,DirectorySummary> summaries;
+            auto previous = mEntries.begin();
+            auto current = entries.begin();
+            while( previous != mEntries.end() || current != entries.end() ){
+                if( current == entries.end() || ( previous != mEntries.end() && previous->first < current->first ) ){
+                    summarize( summaries, previous->first ).removed++;
+                    ++previous;
+                }
+                else if( previous == mEntries.end() || current->first < previous->first ){
+                    summarize( summaries, current->first ).created++;
+                    ++current;
+                }
+                else {
+                    const TreeEntry &before = previous->second;
+                    const TreeEntry &after = current->second;
+                    if( before.directory != after.directory ){
+                        summarize( summaries, current->first ).modified++;
+                    }
+                    // a directory write time only tells that its children changed, which are reported on their own
+                    else if( !after.directory && after.isModifiedSince( before ) ){
+                        summarize( summaries, current->first ).modified++;
+                    }
+                    ++previous;
+                    ++current;
+                }
+            }
+            mEntries.swap( entries );
+            
+            if( summaries.empty() ){
+                return;
+            }
+            std::vector<DirectorySummary> changes;
+            changes.reserve( summaries.size() );
+            for( auto it = summaries.begin(); it != summaries.end(); ++it ){
+                changes.push_back( it->second );
+            }
+#ifdef CINDER_CINDER
+            auto callback = mCallback;
+            ci::app::App::get()->dispatchAsync( [callback,changes](){
+                callback( changes );
+            } );
+#else
+            mCallback( changes );
+#endif
+        }
+        
+    protected:
+        //! Returns the summary of the directory a change to relative is reported in, the parent directory of relative or its ancestor mDepth levels below the watched directory
+        DirectorySummary& summarize( std::map<std::string,DirectorySummary> &summaries, const std::string &relative )
+        {
+            size_t level = 0, end = 0;
+            size_t directoryEnd = relative.rfind( '/' );
+            if( directoryEnd != std::string::npos ){
+                for( size_t pos = 0; pos <= directoryEnd; pos = relative.find( '/', pos ) + 1 ){
+                    if( level < mDepth ){
+                        end = relative.find( '/', pos );
+                    }
+                    ++level;
+                }
+            }
+            
+            std::string directory = relative.substr( 0, end );
+            auto it = summaries.find( directory );
+            if( it == summaries.end() ){
+                DirectorySummary summary;
+                summary.directory   = directory.empty() ? mPath : mPath / directory;
+                summary.created     = 0;
+                summary.modified    = 0;
+                summary.removed     = 0;
+                summary.maxDepth    = 0;
+                it = summaries.insert( std::make_pair( directory, summary ) ).first;
+            }
+            it->second.maxDepth = std::max( it->second.maxDepth, level - std::min( level, mDepth ) );
+            return it->second;
+        }
+        
+        ci::fs::path                                                mPath;
+        size_t                                                      mDepth;
+        std::function<void(const std::vector<DirectorySummary>&)>   mCallback;
+        std::map<std::string,TreeEntry>                             mEntries;
+    };
+    
+    void unsubscribe( const Watcher &watcher )
+    {
+        if( !watcher.getFilter().empty() ){
+            mDirectories.unsubscribe( watcher.getPath() );
+        }
+    }
+    
+    std::mutex                      mMutex;
+    std::atomic<bool>               mWatching;
+    std::unique_ptr<std::thread>    mThread;
+    std::map<std::string,Watcher>   mFileWatchers;
+    DirectoryRegistry               mDirectories;
+    
+    std::mutex                                                  mDirectoryWatchersMutex;
+    std::map<std::string,std::shared_ptr<DirectoryWatcher>>     mDirectoryWatchers;
+    
+    std::mutex                                                  mMirrorsMutex;
+    std::unique_ptr<std::thread>                                mMirrorThread;
+    std::map<std::string,std::shared_ptr<Mirror>>               mMirrors;
+    
+    std::mutex                                                  mVersionsMutex;
+    std::map<std::string,std::shared_ptr<PublishedVersion>>     mVersions;
+};
+
+WATCHDOG_INLINE uint64_t Watchdog::Version::getNumber() const
+{
+    return mData ? mData->mNumber : 0;
+}
+
+WATCHDOG_INLINE size_t Watchdog::Version::size() const
+{
+    return mData ? mData->mTimes.size() : 0;
+}
+
+WATCHDOG_INLINE bool Watchdog::Version::contains( const ci::fs::path &path ) const
+{
+    uint32_t id;
+    return mData && Impl::pathTable().find( path.string(), &id ) && mData->mTimes.find( id );
+}
+
+WATCHDOG_INLINE Watchdog::FileTime Watchdog::Version::getLastWriteTime( const ci::fs::path &path ) const
+{
+    uint32_t id;
+    const FileTime *time = mData && Impl::pathTable().find( path.string(), &id ) ? mData->mTimes.find( id ) : nullptr;
+    if( !time ){
+        throw WatchedFileSystemExc( path );
+    }
+    return *time;
+}
+
+WATCHDOG_INLINE void Watchdog::Version::visit( const std::function<void(const ci::fs::path&,FileTime)> &visitor ) const
+{
+    if( mData ){
+        mData->mTimes.visit( [&visitor]( uint32_t id, const FileTime &time ){
+            visitor( Impl::pathTable().getPath( id ), time );
+        } );
+    }
+}
+
+WATCHDOG_INLINE void Watchdog::watch( const ci::fs::path &path, const std::function<void(const ci::fs::path&)> &callback )
+{
+    Impl::watchImpl( path, callback, std::function<void(const std::vector<ci::fs::path>&)>() );
+}
+
+#ifdef WIN_AMBIGUITY_FIX
+WATCHDOG_INLINE void Watchdog::watchMany( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback )
+#else
+WATCHDOG_INLINE void Watchdog::watch( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback )
+#endif
+{
+    Impl::watchImpl( path, std::function<void(const ci::fs::path&)>(), callback );
+}
+
+WATCHDOG_INLINE void Watchdog::watchDirectories( const ci::fs::path &path, const std::function<void(const std::vector<DirectorySummary>&)> &callback, size_t depth )
+{
+    ci::fs::path p = path;
+#ifdef CINDER_CINDER
+    // try to see if the path is an asset
+    if( !ci::fs::exists( p ) ){
+        ci::fs::path asset = ci::app::getAssetPath( p );
+        if( !asset.empty() ){
+            p = asset;
+        }
+    }
+#endif
+    if( !ci::fs::is_directory( p ) ){
+        throw WatchedFileSystemExc( path );
+    }
+    
+    // scan the tree before taking the lock so the watch thread keeps going
+    auto watcher = std::make_shared<Impl::DirectoryWatcher>( p, depth, callback );
+    
+    Impl &wd = Impl::get();
+    std::lock_guard<std::mutex> lock( wd.mDirectoryWatchersMutex );
+    if( wd.mDirectoryWatchers.find( path.string() ) == wd.mDirectoryWatchers.end() ){
+        wd.mDirectoryWatchers[ path.string() ] = watcher;
+    }
+}
+
+WATCHDOG_INLINE void Watchdog::unwatch( const ci::fs::path &path )
+{
+    Impl::watchImpl( path );
+}
+
+WATCHDOG_INLINE void Watchdog::unwatchAll()
+{
+    Impl::watchImpl( ci::fs::path() );
+}
+
+#if defined( CINDER_WINRT ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1900 ) )
+WATCHDOG_INLINE void Watchdog::touch( const ci::fs::path &path, ci::fs::file_time_type time )
+#else
+WATCHDOG_INLINE void Watchdog::touch( const ci::fs::path &path, std::time_t time )
+#endif
+{
+    // if the file or directory exists change its last write time
+    if( ci::fs::exists( path ) ){
+        ci::fs::last_write_time( path, time );
+        return;
+    }
+    // if not, visit each path if there's a wildcard
+    if( path.string().find( "*" ) != std::string::npos ){
+        Impl::visitWildCardPath( path, [time]( const ci::fs::path &p ){
+            ci::fs::last_write_time( p, time );
+            return false;
+        } );
+    }
+    // otherwise throw an exception
+    else {
+        throw WatchedFileSystemExc( path );
+    }
+}
+
+WATCHDOG_INLINE Watchdog::Version Watchdog::getVersion( const ci::fs::path &path )
+{
+    Impl &wd = Impl::get();
+    std::shared_ptr<Impl::PublishedVersion> published;
+    do {
+        std::lock_guard<std::mutex> lock( wd.mVersionsMutex );
+        auto it = wd.mVersions.find( path.string() );
+        if( it != wd.mVersions.end() ){
+            published = it->second;
+        }
+    } while( false );
+    
+    if( !published ){
+        return Version();
+    }
+    std::lock_guard<std::mutex> lock( published->mMutex );
+    return published->mVersion;
+}
+
+WATCHDOG_INLINE void Watchdog::mirror( const ci::fs::path &source, const ci::fs::path &target )
+{
+    if( !ci::fs::is_directory( source ) ){
+        throw WatchedFileSystemExc( source );
+    }
+    
+    // reconcile both directories before taking the lock so the mirror thread keeps going
+    auto mirror = std::make_shared<Impl::Mirror>( source, target );
+    
+    Impl &wd = Impl::get();
+    std::lock_guard<std::mutex> lock( wd.mMirrorsMutex );
+    wd.mMirrors[ source.string() ] = mirror;
+    wd.startMirrors();
+}
+
+WATCHDOG_INLINE void Watchdog::unmirror( const ci::fs::path &source )
+{
+    Impl &wd = Impl::get();
+    std::lock_guard<std::mutex> lock( wd.mMirrorsMutex );
+    wd.mMirrors.erase( source.string() );
+}
+
+WATCHDOG_INLINE void Watchdog::setSnapshotsEnabled( bool enabled, const ci::fs::path &directory )
+{
+    Impl::snapshotPool().setDirectory( directory );
+    Impl::snapshotsEnabled() = enabled;
+}
+
+WATCHDOG_INLINE void Watchdog::setCoChangePrefetchEnabled( bool enabled )
+{
+    Impl::coChangePrefetchEnabled() = enabled;
+}
+
+WATCHDOG_INLINE void Watchdog::setGitIndexBootstrapEnabled( bool enabled )
+{
+    Impl::gitIndexBootstrapEnabled() = enabled;
+}
+
+WATCHDOG_INLINE void SleepyWatchdog::watch( const ci::fs::path &path, const std::function<void(const ci::fs::path&)> &callback )
+{
+    auto pathFilter = Watchdog::Impl::visitWildCardPath( path, []( const ci::fs::path &p ){ return false; } );
+    if( pathFilter.first.empty() ){
+        throw WatchedFileSystemExc( path );
+    }
+    else {
+        callback( pathFilter.first );
+    }
+}
+
+#ifdef WIN_AMBIGUITY_FIX
+WATCHDOG_INLINE void SleepyWatchdog::watchMany( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback )
+#else
+WATCHDOG_INLINE void SleepyWatchdog::watch( const ci::fs::path &path, const std::function<void(const std::vector<ci::fs::path>&)> &callback )
+#endif
+{
+    auto pathFilter = Watchdog::Impl::visitWildCardPath( path, []( const ci::fs::path &p ){ return false; } );
+    if( pathFilter.first.empty() ){
+        throw WatchedFileSystemExc( path );
+    }
+    else {
+        // TODO: this is wrong
+        callback( std::vector<ci::fs::path>() );
+    }
+}
+
+WATCHDOG_INLINE void SleepyWatchdog::mirror( const ci::fs::path &source, const ci::fs::path &target )
+{
+    if( !ci::fs::is_directory( source ) ){
+        throw WatchedFileSystemExc( source );
+    }
+    Watchdog::Impl::Mirror( source, target );
+}
@@ -0,0 +1,163 @@
+// Parses hand-built git indexes in the on-disk formats git writes, see
+// Documentation/technical/index-format.txt in the git sources.
+#include "Watchdog.h"
+
+#include <iostream>
+
+namespace {
+    
+    struct WatchdogTest : public Watchdog {
+        using Watchdog::Impl;
+    };
+    typedef WatchdogTest::Impl::GitIndexEntry GitIndexEntry;
+    
+    struct TestEntry {
+        std::string mPath;
+        uint32_t    mMode;
+        uint32_t    mTime;
+        uint32_t    mSize;
+        uint16_t    mFlags;
+        uint16_t    mExtendedFlags;
+    };
+    
+    void write16( std::string &data, uint32_t value )
+    {
+        data += static_cast<char>( ( value >> 8 ) & 0xff );
+        data += static_cast<char>( value & 0xff );
+    }
+    
+    void write32( std::string &data, uint32_t value )
+    {
+        write16( data, value >> 16 );
+        write16( data, value & 0xffff );
+    }
+    
+    std::string buildIndex( uint32_t version, const std::vector<TestEntry> &entries )
+    {
+        std::string data = "DIRC";
+        write32( data, version );
+        write32( data, static_cast<uint32_t>( entries.size() ) );
+        
+        std::string previous;
+        for( const auto &entry : entries ){
+            size_t entryStart = data.size();
+            write32( data, entry.mTime );   // ctime
+            write32( data, 0 );
+            write32( data, entry.mTime );   // mtime
+            write32( data, 123 );
+            write32( data, 0 );             // dev
+            write32( data, 0 );             // ino
+            write32( data, entry.mMode );
+            write32( data, 0 );             // uid
+            write32( data, 0 );             // gid
+            write32( data, entry.mSize );
+            data.append( 20, '\x5a' );      // sha1
+            uint32_t flags = entry.mFlags | std::min<uint32_t>( static_cast<uint32_t>( entry.mPath.size() ), 0xfff );
+            if( entry.mExtendedFlags ) flags |= 0x4000;
+            write16( data, flags );
+            if( entry.mExtendedFlags ) write16( data, entry.mExtendedFlags );
+            
+            if( version == 4 ){
+                // strip length as an offset varint, then the new suffix
+                size_t common = 0;
+                while( common < previous.size() && common < entry.mPath.size() && previous[common] == entry.mPath[common] ) ++common;
+                size_t strip = previous.size() - common;
+                std::string varint( 1, static_cast<char>( strip & 127 ) );
+                while( strip >>= 7 ){
+                    --strip;
+                    varint.insert( varint.begin(), static_cast<char>( 128 | ( strip & 127 ) ) );
+                }
+                data += varint;
+                data += entry.mPath.substr( common );
+                data += '\0';
+            }
+            else {
+                data += entry.mPath;
+                size_t length = data.size() - entryStart;
+                data.append( 8 - length % 8, '\0' );
+            }
+            previous = entry.mPath;
+        }
+        
+        // the trailing checksum is not verified
+        data.append( 20, '\0' );
+        return data;
+    }
+    
+    int failures = 0;
+    
+    void check( bool condition, const std::string &what )
+    {
+        if( !condition ){
+            std::cerr << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+    
+    void checkVersion( uint32_t version )
+    {
+        const uint32_t indexTime = 2000;
+        std::string longName = "d/" + std::string( 150, 'x' ) + ".txt";
+        std::vector<TestEntry> entries = {
+            { "a.txt",          0100644, 1000, 11,  0,      0 },
+            { "d/f1.txt",       0100644, 1001, 12,  0,      0 },
+            { "d/f2.txt",       0100755, 1002, 13,  0,      0 },
+            { "d/link",         0120000, 1003, 14,  0,      0 },
+            { "d/racy.txt",     0100644, 2000, 15,  0,      0 },
+            { "d/sub/f3.txt",   0100644, 1004, 16,  0,      0 },
+            { longName,         0100644, 1005, 17,  0,      0 },
+            { "e/conflict.txt", 0100644, 1006, 18,  0x1000, 0 },
+        };
+        if( version >= 3 ){
+            entries.push_back( { "e/skipped.txt", 0100644, 1007, 19, 0, 0x4000 } );
+            entries.push_back( { "e/tracked.txt", 0100644, 1008, 20, 0, 0x0000 } );
+        }
+        
+        std::string prefix = "v" + std::to_string( version ) + ": ";
+        auto parsed = WatchdogTest::Impl::parseGitIndex( buildIndex( version, entries ), indexTime );
+        
+        auto expect = [&]( const std::string &path, std::time_t time, uint32_t size ){
+            auto it = parsed.find( path );
+            check( it != parsed.end(), prefix + path + " missing" );
+            if( it != parsed.end() ){
+                check( it->second.mTime == time, prefix + path + " mtime" );
+                check( it->second.mTimeNsec == 123, prefix + path + " mtime nsec" );
+                check( it->second.mSize == size, prefix + path + " size" );
+            }
+        };
+        expect( "a.txt", 1000, 11 );
+        expect( "d/f1.txt", 1001, 12 );
+        expect( "d/f2.txt", 1002, 13 );
+        expect( "d/sub/f3.txt", 1004, 16 );
+        expect( longName, 1005, 17 );
+        check( !parsed.count( "d/link" ), prefix + "symlinks are skipped" );
+        check( !parsed.count( "d/racy.txt" ), prefix + "racy entries are skipped" );
+        check( !parsed.count( "e/conflict.txt" ), prefix + "unmerged entries are skipped" );
+        if( version >= 3 ){
+            check( !parsed.count( "e/skipped.txt" ), prefix + "skip-worktree entries are skipped" );
+            expect( "e/tracked.txt", 1008, 20 );
+        }
+        check( parsed.size() == ( version >= 3 ? 6u : 5u ), prefix + "entry count" );
+        
+        // a truncated index keeps whatever was parsed before the cut
+        std::string data = buildIndex( version, entries );
+        auto truncated = WatchdogTest::Impl::parseGitIndex( data.substr( 0, 12 + 62 + 10 ), indexTime );
+        check( truncated.size() == 1 && truncated.count( "a.txt" ), prefix + "truncated index" );
+    }
+    
+}
+
+int main()
+{
+    checkVersion( 2 );
+    checkVersion( 3 );
+    checkVersion( 4 );
+    
+    check( WatchdogTest::Impl::parseGitIndex( "", 0 ).empty(), "empty index" );
+    check( WatchdogTest::Impl::parseGitIndex( buildIndex( 5, {} ), 0 ).empty(), "unknown version" );
+    
+    if( failures == 0 ){
+        std::cout << "git index parsing ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+// Checks the append-only table interning the watched paths, in particular the
+// chunk boundaries and the lookups after the index grows.
+#include "Watchdog.h"
+
+#include <iostream>
+
+namespace {
+    
+    struct WatchdogTest : public Watchdog {
+        using Watchdog::Impl;
+    };
+    
+    struct PathTableTest : public WatchdogTest::Impl::PathTable {
+        using PathTable::locate;
+        using PathTable::chunkSize;
+    };
+    
+    int failures = 0;
+    
+    void check( bool condition, const std::string &what )
+    {
+        if( !condition ){
+            std::cerr << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+    
+    void checkLocation( uint32_t id, size_t expectedChunk, size_t expectedOffset )
+    {
+        size_t chunk, offset;
+        PathTableTest::locate( id, &chunk, &offset );
+        check( chunk == expectedChunk && offset == expectedOffset, "location of id " + std::to_string( id ) );
+        check( offset < PathTableTest::chunkSize( chunk ), "offset of id " + std::to_string( id ) + " fits its chunk" );
+    }
+    
+    void checkLocations()
+    {
+        checkLocation( 0, 0, 0 );
+        checkLocation( 1023, 0, 1023 );
+        checkLocation( 1024, 1, 0 );
+        checkLocation( 3071, 1, 2047 );
+        checkLocation( 3072, 2, 0 );
+        checkLocation( 7167, 2, 4095 );
+        checkLocation( 7168, 3, 0 );
+        // the last chunk starts 1024 ids before the end of the id range
+        checkLocation( 0xffffffffu, 22, 1023 );
+    }
+    
+    void checkInterning()
+    {
+        PathTableTest table;
+        // past several chunk boundaries and index growths
+        const uint32_t count = 10000;
+        for( uint32_t i = 0; i < count; ++i ){
+            check( table.intern( "/watched/" + std::to_string( i ) ) == i, "ids are given in order" );
+        }
+        
+        bool resolved = true;
+        for( uint32_t i = 0; i < count; ++i ){
+            std::string path = "/watched/" + std::to_string( i );
+            uint32_t id = count;
+            resolved = resolved && table.find( path, &id ) && id == i && table.getPath( i ) == path;
+        }
+        check( resolved, "ids still resolve after the index grew" );
+        
+        check( table.intern( "/watched/1023" ) == 1023 && table.intern( "/watched/1024" ) == 1024, "interning again returns the same id" );
+        
+        uint32_t id;
+        check( !table.find( "/watched/" + std::to_string( count ), &id ), "unknown paths are not found" );
+        check( !table.find( "", &id ), "the empty path is not found" );
+    }
+    
+}
+
+int main()
+{
+    checkLocations();
+    checkInterning();
+    
+    if( failures == 0 ){
+        std::cout << "path table ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
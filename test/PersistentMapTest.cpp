@@ -0,0 +1,118 @@
+// Checks the hash array mapped trie keeping the watchers state, in particular
+// keys sharing their bits down to the last level and copies sharing nodes.
+#include "Watchdog.h"
+
+#include <iostream>
+
+namespace {
+    
+    struct WatchdogTest : public Watchdog {
+        template<typename T> using PersistentMap = Watchdog::PersistentMap<T>;
+    };
+    typedef WatchdogTest::PersistentMap<int> Map;
+    
+    int failures = 0;
+    
+    void check( bool condition, const std::string &what )
+    {
+        if( !condition ){
+            std::cerr << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+    
+    bool holds( const Map &map, uint32_t key, int value )
+    {
+        const int *found = map.find( key );
+        return found && *found == value;
+    }
+    
+    void checkCollisions()
+    {
+        // 5 bits per level, these only differ in the two bits of the last level
+        const uint32_t keys[] = { 0x00000000, 0x40000000, 0x80000000, 0xC0000000 };
+        Map map;
+        for( int i = 0; i < 4; ++i ){
+            map.insert( keys[i], i );
+        }
+        check( map.size() == 4, "colliding keys are all inserted" );
+        for( int i = 0; i < 4; ++i ){
+            check( holds( map, keys[i], i ), "colliding key " + std::to_string( i ) + " is found" );
+        }
+        check( !map.find( 0x20000000 ), "a key missing from the last level is not found" );
+        
+        map.insert( keys[2], 20 );
+        check( map.size() == 4, "overwriting a colliding key keeps the size" );
+        check( holds( map, keys[2], 20 ), "overwritten colliding key" );
+        check( holds( map, keys[1], 1 ) && holds( map, keys[3], 3 ), "overwriting leaves the other colliding keys" );
+        
+        map.erase( keys[1] );
+        check( map.size() == 3, "erasing a colliding key" );
+        check( !map.find( keys[1] ), "erased colliding key is gone" );
+        check( holds( map, keys[0], 0 ) && holds( map, keys[2], 20 ) && holds( map, keys[3], 3 ), "erasing leaves the other colliding keys" );
+        
+        map.erase( keys[1] );
+        check( map.size() == 3, "erasing a missing key does nothing" );
+        
+        for( uint32_t key : keys ){
+            map.erase( key );
+        }
+        check( map.size() == 0, "all colliding keys erased" );
+        size_t visited = 0;
+        map.visit( [&visited]( uint32_t, const int & ){ ++visited; } );
+        check( visited == 0, "an emptied map visits nothing" );
+        
+        map.insert( keys[3], 33 );
+        check( map.size() == 1 && holds( map, keys[3], 33 ), "reinserting after erasing everything" );
+    }
+    
+    void checkCopies()
+    {
+        Map map;
+        for( uint32_t i = 0; i < 2000; ++i ){
+            map.insert( i * 2654435761u, static_cast<int>( i ) );
+        }
+        Map old = map;
+        
+        for( uint32_t i = 0; i < 2000; i += 2 ){
+            map.erase( i * 2654435761u );
+        }
+        for( uint32_t i = 1; i < 2000; i += 4 ){
+            map.insert( i * 2654435761u, -1 );
+        }
+        map.insert( 0xC0000000, 7 );
+        map.insert( 0x80000000, 8 );
+        
+        check( old.size() == 2000, "the old copy keeps its size" );
+        bool unchanged = true;
+        for( uint32_t i = 0; i < 2000; ++i ){
+            unchanged = unchanged && holds( old, i * 2654435761u, static_cast<int>( i ) );
+        }
+        check( unchanged, "the old copy keeps its values" );
+        check( !old.find( 0xC0000000 ) && !old.find( 0x80000000 ), "the old copy doesn't see new keys" );
+        size_t visited = 0;
+        old.visit( [&visited]( uint32_t, const int & ){ ++visited; } );
+        check( visited == 2000, "the old copy visits all its entries" );
+        
+        check( map.size() == 1002, "the live map size" );
+        bool modified = true;
+        for( uint32_t i = 0; i < 2000; ++i ){
+            const int *value = map.find( i * 2654435761u );
+            if( i % 2 == 0 ) modified = modified && !value;
+            else modified = modified && value && *value == ( i % 4 == 1 ? -1 : static_cast<int>( i ) );
+        }
+        check( modified, "the live map values" );
+    }
+    
+}
+
+int main()
+{
+    checkCollisions();
+    checkCopies();
+    
+    if( failures == 0 ){
+        std::cout << "persistent map ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}